@@ -1,3 +1,4 @@
+#include <thread>
 #include "assocs.h"
 #include "regexmacros.h"
 
@@ -5,6 +6,11 @@ const regex bang_re ("^!", regex_constants::basic);
 const regex nonwhite_re (RE_NONWHITE_CHAR_CLASS, regex_constants::basic);
 
 void Assocs::parseGOA (istream& in) {
+  GeneTermList gt = readGOA (in);
+  init (gt);
+}
+
+Assocs::GeneTermList Assocs::readGOA (istream& in) {
   GeneTermList gt;
   string line;
   while (in && !in.eof()) {
@@ -22,7 +28,7 @@ void Assocs::parseGOA (istream& in) {
       }
     }
   }
-  init (gt);
+  return gt;
 }
 
 Assocs::GeneNameSet Assocs::parseGeneSet (istream& in) {
@@ -36,33 +42,111 @@ Assocs::GeneNameSet Assocs::parseGeneSet (istream& in) {
   return gs;
 }
 
-void Assocs::init (GeneTermList& geneTermList) {
-  auto closure = ontology.transitiveClosure();
-  set<TermName> missing;
-  vguard<set<GeneIndex> > genesByTerm_set (terms());
+vguard<Assocs::NamedGeneSet> Assocs::parseGMT (istream& in) {
+  vguard<NamedGeneSet> sets;
+  string line;
+  while (in && !in.eof()) {
+    getline(in,line);
+    if (regex_search (line, nonwhite_re)) {
+      const auto f = split (line, "\t\r", true);
+      GeneNameSet gs;
+      for (size_t n = 2; n < f.size(); ++n)
+	if (regex_search (f[n], nonwhite_re))
+	  gs.push_back (f[n]);
+      sets.push_back (NamedGeneSet (f[0], gs));
+    }
+  }
+  return sets;
+}
+
+void Assocs::init (const GeneTermList& geneTermList, PhaseTimer* timer) {
+  const auto phaseStart = PhaseTimer::now();
+  const auto closure = ontology.transitiveClosure (nThreads);
+  if (timer)
+    timer->add ("transitive closure", phaseStart);
+  init (geneTermList, closure, timer);
+}
+
+void Assocs::init (const GeneTermList& geneTermList, const vguard<set<TermIndex> >& closure, PhaseTimer* timer) {
+  auto phaseStart = PhaseTimer::now();
+  auto endPhase = [&] (const char* phase) {
+    if (timer)
+      timer->add (phase, phaseStart);
+    phaseStart = PhaseTimer::now();
+  };
+
+  // index genes in order of appearance, then each thread takes every nThreads'th gene
+  vguard<vguard<const TermName*> > termNamesByGene (genes());
   for (auto& gt : geneTermList) {
     if (!geneIndex.count(gt.first)) {
       geneIndex[gt.first] = genes();
       geneName.push_back (gt.first);
       termsByGene.push_back (set<TermIndex>());
+      termNamesByGene.push_back (vguard<const TermName*>());
     }
-    auto g = geneIndex[gt.first];
-    if (!ontology.termIndex.count(gt.second))
-      missing.insert (gt.second);
-    else {
-      const auto& terms = closure[ontology.termIndex.at(gt.second)];
-      termsByGene[g].insert (terms.begin(), terms.end());
-      for (auto t : terms)
-	genesByTerm_set[t].insert (g);
-      nAssocs += terms.size();
+    termNamesByGene[geneIndex[gt.first]].push_back (&gt.second);
+  }
+
+  // per-thread buffers, indexed by term; genes are visited in order, so each buffer is sorted (but may repeat)
+  vguard<vguard<vguard<GeneIndex> > > genesByTermBuffer (nThreads, vguard<vguard<GeneIndex> > (terms()));
+  vguard<set<TermName> > missingBuffer (nThreads);
+  vguard<int> nAssocsBuffer (nThreads, 0);
+  auto addGenes = [&] (size_t first) {
+    auto& buffer = genesByTermBuffer[first];
+    for (GeneIndex g = first; g < genes(); g += nThreads) {
+      auto addTerms = [&] (const set<TermIndex>& terms) {
+	termsByGene[g].insert (terms.begin(), terms.end());
+	for (auto t : terms)
+	  buffer[t].push_back (g);
+	nAssocsBuffer[first] += terms.size();
+      };
+      for (auto tn : termNamesByGene[g]) {
+	auto iter = ontology.termIndex.find (*tn);
+	if (iter != ontology.termIndex.end())
+	  addTerms (closure[iter->second]);
+	else if (ontology.isPruned (*tn)) {
+	  set<TermIndex> terms;
+	  for (auto t : ontology.prunedTermAncestors.at(*tn))
+	    terms.insert (closure[t].begin(), closure[t].end());
+	  addTerms (terms);
+	} else
+	  missingBuffer[first].insert (*tn);
+      }
     }
+  };
+  // merge the buffers, each thread taking every nThreads'th term
+  auto mergeTerms = [&] (size_t first) {
+    for (TermIndex t = first; t < terms(); t += nThreads) {
+      vguard<GeneIndex>& gbt = genesByTerm[t];
+      for (auto& buffer : genesByTermBuffer) {
+	gbt.insert (gbt.end(), buffer[t].begin(), buffer[t].end());
+	vguard<GeneIndex>().swap (buffer[t]);
+      }
+      sort (gbt.begin(), gbt.end());
+      gbt.erase (unique (gbt.begin(), gbt.end()), gbt.end());
+    }
+  };
+  auto runThreads = [&] (function<void(size_t)> work) {
+    if (nThreads > 1) {
+      list<thread> threads;
+      for (size_t t = 0; t < nThreads; ++t)
+	threads.push_back (thread (work, t));
+      for (auto& thr: threads)
+	thr.join();
+    } else
+      work (0);
+  };
+  runThreads (addGenes);
+  runThreads (mergeTerms);
+
+  set<TermName> missing;
+  for (size_t t = 0; t < nThreads; ++t) {
+    missing.insert (missingBuffer[t].begin(), missingBuffer[t].end());
+    nAssocs += nAssocsBuffer[t];
   }
   if (missing.size())
     Warn ("Terms not found in the ontology: %s", join(missing).c_str());
-  for (TermIndex t = 0; t < terms(); ++t) {
-    genesByTerm_set[t].insert (genesByTerm[t].begin(), genesByTerm[t].end());
-    genesByTerm[t] = vguard<GeneIndex> (genesByTerm_set[t].begin(), genesByTerm_set[t].end());
-  }
+  endPhase ("gene-term index");
 
   map<vguard<GeneIndex>,TermEquivClassIndex> termClass;
   const auto toposort = ontology.toposortTermIndex();
@@ -76,4 +160,5 @@ void Assocs::init (GeneTermList& geneTermList) {
     equivClassByTerm[term] = c;
     termsInEquivClass[c].push_back (term);
   }
+  endPhase ("equivalence classes");
 }
@@ -8,6 +8,7 @@
 #include "ontology.h"
 #include "util.h"
 #include "logsumexp.h"
+#include "logger.h"
 
 struct Assocs {
   typedef string GeneName;
@@ -19,6 +20,7 @@ struct Assocs {
 
   typedef set<GeneIndex> GeneIndexSet;
   typedef list<GeneName> GeneNameSet;
+  typedef pair<string,GeneNameSet> NamedGeneSet;
 
   typedef map<TermName,double> TermProb;
   typedef map<GeneName,double> GeneProb;
@@ -33,15 +35,29 @@ struct Assocs {
   vguard<vguard<TermIndex> > termsInEquivClass;
   vguard<TermEquivClassIndex> equivClassByTerm;
   int nAssocs;
+  size_t nThreads;  // used by init
 
   Assocs (const Ontology& ontology)
     : ontology(ontology),
       genesByTerm(ontology.terms()),
       equivClassByTerm(ontology.terms()),
-      nAssocs(0)
+      nAssocs(0),
+      nThreads(1)
   { }
 
   GeneIndex genes() const { return geneName.size(); }
+  size_t genesByTermBytes() const {
+    size_t b = vector_bytes(genesByTerm);
+    for (auto& gbt : genesByTerm)
+      b += vector_bytes(gbt);
+    return b;
+  }
+  size_t termsByGeneBytes() const {
+    size_t b = vector_bytes(termsByGene);
+    for (auto& tbg : termsByGene)
+      b += set_bytes(tbg);
+    return b;
+  }
   TermIndex terms() const { return ontology.termName.size(); }
   bool geneHasTerm (GeneIndex g, TermIndex t) const { return termsByGene[g].count(t) > 0; }
   bool termIsExemplar (TermIndex t) const { return termsInEquivClass[equivClassByTerm[t]][0] == t; }
@@ -64,10 +80,14 @@ struct Assocs {
     return termEquiv;
   }
 
-  void init (GeneTermList& geneTermList);
+  void init (const GeneTermList& geneTermList, PhaseTimer* timer = NULL);  // logs phase times to timer, if given
+  void init (const GeneTermList& geneTermList, const vguard<set<TermIndex> >& closure, PhaseTimer* timer = NULL);  // closure already computed
   void parseGOA (istream& in);
 
+  static GeneTermList readGOA (istream& in);  // parse without init, e.g. to prune the ontology first
+
   static GeneNameSet parseGeneSet (istream& in);
+  static vguard<NamedGeneSet> parseGMT (istream& in);  // one tab-separated set per line: name, description, genes
   
   TermProb hypergeometricPValues (const GeneIndexSet& geneSet, double pValueThreshold = .05) const {
     TermProb hyp;
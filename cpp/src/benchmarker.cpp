@@ -0,0 +1,181 @@
+#include <thread>
+#include "benchmarker.h"
+
+// JSON has no NaN, so (like JSON.stringify) write null
+static string numToJSON (double x) {
+  if (std::isnan(x))
+    return string("null");
+  ostringstream json;
+  json << x;
+  return json.str();
+}
+
+static string numToCSV (double x) {
+  if (std::isnan(x))
+    return string("NaN");
+  ostringstream csv;
+  csv << x;
+  return csv.str();
+}
+
+// mean & sample standard deviation, as jStat.mean & jStat.stdev(x,true)
+static Benchmarker::Stat summarize (const vguard<double>& x) {
+  Benchmarker::Stat stat;
+  stat.n = x.size();
+  double sum = 0, sumSq = 0;
+  for (auto v : x)
+    sum += v;
+  stat.mean = sum / stat.n;
+  for (auto v : x)
+    sumSq += (v - stat.mean) * (v - stat.mean);
+  stat.stdev = sqrt (sumSq / (stat.n - 1.));
+  return stat;
+}
+
+string Benchmarker::Stat::toJSON() const {
+  return string("{\"mean\":") + numToJSON(mean) + ",\"stdev\":" + numToJSON(stdev) + ",\"n\":" + to_string(n) + "}";
+}
+
+string Benchmarker::ThresholdStats::toJSON() const {
+  return string("{\"threshold\":") + numToJSON(threshold)
+    + ",\"recall\":" + recall.toJSON()
+    + ",\"specificity\":" + specificity.toJSON()
+    + ",\"precision\":" + precision.toJSON()
+    + ",\"fpr\":" + fpr.toJSON() + "}";
+}
+
+Benchmarker::TermScores Benchmarker::termScores (const Assocs::TermProb& termProb) const {
+  TermScores scores;
+  for (auto& tp : termProb) {
+    auto iter = ontology.termIndex.find (tp.first);
+    if (iter == ontology.termIndex.end())
+      Warn ("Term %s not found in the ontology", tp.first.c_str());
+    else
+      scores.push_back (TermScore (iter->second, tp.second));
+  }
+  return scores;
+}
+
+void Benchmarker::add (const Simulator::Simulation& sim, const MCMC::Summary& summ) {
+  Assert (sim.samples.size() == summ.geneSetSummary.size(), "Simulation & inference results have different numbers of gene sets");
+  Dataset ds;
+  for (size_t n = 0; n < sim.samples.size(); ++n) {
+    ds.trueTerms.push_back (sim.samples[n].term);
+    ds.hypergeometricPValue.push_back (termScores (summ.geneSetSummary[n].hypergeometricPValue));
+    ds.termPosterior.push_back (termScores (summ.geneSetSummary[n].termPosterior));
+  }
+  datasets.push_back (ds);
+}
+
+void Benchmarker::analyze() {
+  hypergeometric = analyzeScoring (true);
+  model = analyzeScoring (false);
+}
+
+Benchmarker::Analysis Benchmarker::analyzeScoring (bool usePValues) const {
+  // thresholds are the centiles of all the reported scores
+  vguard<double> allScores;
+  for (auto& ds : datasets)
+    for (auto& scores : (usePValues ? ds.hypergeometricPValue : ds.termPosterior))
+      for (auto& ts : scores)
+	allScores.push_back (ts.second);
+  sort (allScores.begin(), allScores.end());
+  vguard<double> thresholds;
+  if (!allScores.empty())
+    for (size_t centile = 0; centile <= 100; ++centile)
+      thresholds.push_back (allScores[centile * (allScores.size() - 1) / 100]);
+  thresholds.erase (unique (thresholds.begin(), thresholds.end()), thresholds.end());
+  const size_t nThresholds = thresholds.size();
+
+  vguard<size_t> firstSample (1, 0);
+  for (auto& ds : datasets)
+    firstSample.push_back (firstSample.back() + ds.trueTerms.size());
+  vguard<vguard<Counts> > counts (firstSample.back());  // indexed by sample & threshold
+
+  // sort each gene set's scores once, then sweep all thresholds in a single pass.
+  // a term passes if its key (p-value, or minus posterior) is <= the threshold's key
+  auto countDatasets = [&] (size_t first) {
+    vguard<bool> isTrue (terms(), false);
+    vguard<pair<double,bool> > keys;
+    for (size_t d = first; d < datasets.size(); d += nThreads) {
+      const Dataset& ds = datasets[d];
+      const vguard<TermScores>& dsScores = usePValues ? ds.hypergeometricPValue : ds.termPosterior;
+      for (size_t n = 0; n < ds.trueTerms.size(); ++n) {
+	const vguard<TermIndex>& trueTerms = ds.trueTerms[n];
+	for (auto t : trueTerms)
+	  isTrue[t] = true;
+	keys.clear();
+	for (auto& ts : dsScores[n])
+	  keys.push_back (pair<double,bool> (usePValues ? ts.second : -ts.second, isTrue[ts.first]));
+	sort (keys.begin(), keys.end());
+	vguard<Counts>& c = counts[firstSample[d] + n];
+	c.resize (nThresholds);
+	size_t k = 0;
+	int nPassed = 0, nTruePassed = 0;
+	for (size_t i = 0; i < nThresholds; ++i) {
+	  const size_t nt = usePValues ? i : (nThresholds - 1 - i);
+	  const double thresholdKey = usePValues ? thresholds[nt] : -thresholds[nt];
+	  for (; k < keys.size() && keys[k].first <= thresholdKey; ++k) {
+	    ++nPassed;
+	    if (keys[k].second)
+	      ++nTruePassed;
+	  }
+	  Counts& cnt = c[nt];
+	  cnt.tp = nTruePassed;
+	  cnt.fp = nPassed - nTruePassed;
+	  cnt.fn = trueTerms.size() - nTruePassed;
+	  cnt.tn = terms() - cnt.tp - cnt.fp - cnt.fn;
+	}
+	for (auto t : trueTerms)
+	  isTrue[t] = false;
+      }
+    }
+  };
+  if (nThreads > 1) {
+    list<thread> threads;
+    for (size_t t = 0; t < nThreads; ++t)
+      threads.push_back (thread (countDatasets, t));
+    for (auto& thr: threads)
+      thr.join();
+  } else
+    countDatasets (0);
+
+  Analysis analysis;
+  for (size_t nt = 0; nt < nThresholds; ++nt) {
+    vguard<double> recall, specificity, precision, fpr;
+    auto addRatio = [] (vguard<double>& x, int a, int b) {
+      if (a + b > 0)
+	x.push_back (a / (double) (a + b));
+    };
+    for (auto& c : counts) {
+      const Counts& cnt = c[nt];
+      addRatio (recall, cnt.tp, cnt.fn);
+      addRatio (specificity, cnt.tn, cnt.fp);
+      addRatio (precision, cnt.tp, cnt.fp);
+      addRatio (fpr, cnt.fp, cnt.tn);
+    }
+    ThresholdStats ts;
+    ts.threshold = thresholds[nt];
+    ts.recall = summarize (recall);
+    ts.specificity = summarize (specificity);
+    ts.precision = summarize (precision);
+    ts.fpr = summarize (fpr);
+    analysis.push_back (ts);
+  }
+  return analysis;
+}
+
+string Benchmarker::analysisToJSON() const {
+  list<string> hypJson, modelJson;
+  for (auto& ts : hypergeometric)
+    hypJson.push_back (ts.toJSON());
+  for (auto& ts : model)
+    modelJson.push_back (ts.toJSON());
+  return string("{\"hypergeometric\":[") + join(hypJson,",") + "],\"model\":[" + join(modelJson,",") + "]}";
+}
+
+void Benchmarker::writeCSV (ostream& out, const Analysis& analysis) {
+  out << "threshold,recall,specificity,precision,fpr,precision_n" << endl;
+  for (auto& ts : analysis)
+    out << numToCSV(ts.threshold) << ',' << numToCSV(ts.recall.mean) << ',' << numToCSV(ts.specificity.mean) << ',' << numToCSV(ts.precision.mean) << ',' << numToCSV(ts.fpr.mean) << ',' << ts.precision.n << endl;
+}
@@ -0,0 +1,62 @@
+#ifndef BENCHMARKER_INCLUDED
+#define BENCHMARKER_INCLUDED
+
+#include "mcmc.h"
+#include "simulator.h"
+
+struct Benchmarker {
+  typedef Ontology::TermIndex TermIndex;
+  typedef pair<TermIndex,double> TermScore;
+  typedef vguard<TermScore> TermScores;  // reported terms only
+
+  // one benchmark dataset: the true terms & inferred scores for each simulated gene set
+  struct Dataset {
+    vguard<vguard<TermIndex> > trueTerms;
+    vguard<TermScores> hypergeometricPValue, termPosterior;
+  };
+
+  struct Stat {
+    double mean, stdev;
+    size_t n;
+    string toJSON() const;
+  };
+
+  struct ThresholdStats {
+    double threshold;
+    Stat recall, specificity, precision, fpr;
+    string toJSON() const;
+  };
+
+  typedef vguard<ThresholdStats> Analysis;
+
+  const Ontology& ontology;
+  vguard<Dataset> datasets;
+  size_t nThreads;
+
+  Analysis hypergeometric, model;
+
+  Benchmarker (const Ontology& ontology)
+    : ontology(ontology),
+      nThreads(1)
+  { }
+
+  TermIndex terms() const { return ontology.terms(); }
+
+  TermScores termScores (const Assocs::TermProb& termProb) const;
+  void add (const Simulator::Simulation& sim, const MCMC::Summary& summ);
+
+  void analyze();
+
+  string analysisToJSON() const;
+  static void writeCSV (ostream& out, const Analysis& analysis);
+
+private:
+  struct Counts {
+    int tp, fp, fn, tn;
+  };
+
+  // p-values pass a threshold from below, posteriors from above
+  Analysis analyzeScoring (bool usePValues) const;
+};
+
+#endif /* BENCHMARKER_INCLUDED */
@@ -6,6 +6,14 @@ LogProb logBetaBernoulli (double alpha, double beta, double succ, double fail) {
   return gsl_sf_lnbeta (alpha + succ, beta + fail) - gsl_sf_lnbeta (alpha, beta);
 }
 
+LogProb deltaLogBetaBernoulli (double succ, double fail, double deltaSucc, double deltaFail) {
+  return gsl_sf_lnbeta (succ + deltaSucc + 1, fail + deltaFail + 1) - gsl_sf_lnbeta (succ + 1, fail + 1);
+}
+
+LogProb logBeta (double alpha, double beta) {
+  return gsl_sf_lnbeta (alpha, beta);
+}
+
 LogProb BernoulliCounts::logBetaBernoulli (const BernoulliCounts& prior) const {
   LogProb lp = 0;
   for (int n = 0; n < nParams(); ++n)
@@ -17,8 +25,18 @@ LogProb BernoulliCounts::deltaLogBetaBernoulli (const BernoulliCounts& delta) co
   LogProb lp = 0;
   for (int n = 0; n < nParams(); ++n)
     if (delta.succ[n] != 0 || delta.fail[n] != 0)
-      lp += gsl_sf_lnbeta (succ[n] + delta.succ[n] + 1, fail[n] + delta.fail[n] + 1)
-	- gsl_sf_lnbeta (succ[n] + 1, fail[n] + 1);
+      lp += ::deltaLogBetaBernoulli (succ[n], fail[n], delta.succ[n], delta.fail[n]);
+  return lp;
+}
+
+LogProb BernoulliCounts::logBernoulli (const BernoulliLogParams& logParams) const {
+  LogProb lp = 0;
+  for (int n = 0; n < nParams(); ++n) {
+    if (succ[n] != 0)
+      lp += succ[n] * logParams.logSucc[n];
+    if (fail[n] != 0)
+      lp += fail[n] * logParams.logFail[n];
+  }
   return lp;
 }
 
@@ -43,6 +61,16 @@ string BernoulliCounts::countsToJSON (const vguard<BernoulliParamName>& params,
   return json.str();
 }
 
+BernoulliLogParams::BernoulliLogParams (const BernoulliParams& params)
+  : logSucc (params.size()),
+    logFail (params.size())
+{
+  for (size_t n = 0; n < params.size(); ++n) {
+    logSucc[n] = log (params[n]);
+    logFail[n] = log (1 - params[n]);
+  }
+}
+
 BernoulliCounts BernoulliParamSet::laplaceCounts() const {
   BernoulliCounts c (nParams());
   for (BernoulliParamIndex p = 0; p < nParams(); ++p)
@@ -8,11 +8,51 @@
 #include "logsumexp.h"
 
 LogProb logBetaBernoulli (double alpha, double beta, double succ, double fail);
+LogProb deltaLogBetaBernoulli (double succ, double fail, double deltaSucc, double deltaFail);  // change in log Beta(succ+1,fail+1)
+LogProb logBeta (double alpha, double beta);
 
 typedef string BernoulliParamName;
 typedef int BernoulliParamIndex;
 typedef vguard<double> BernoulliParams;
 
+// log-probabilities of success & failure, precomputed for repeated likelihood evaluations
+struct BernoulliLogParams {
+  vguard<LogProb> logSucc, logFail;
+  BernoulliLogParams (const BernoulliParams& params);
+};
+
+class BernoulliCounts;
+
+// integer counts for a number of parameters fixed at compile time, e.g. the change a move makes.
+// these live on the stack, so building them allocates nothing
+template<int N>
+struct FixedBernoulliCounts {
+  int succ[N], fail[N];
+  FixedBernoulliCounts() {
+    for (int n = 0; n < N; ++n)
+      succ[n] = fail[n] = 0;
+  }
+  static int nParams() { return N; }
+  FixedBernoulliCounts& operator+= (const FixedBernoulliCounts& c) {
+    for (int n = 0; n < N; ++n) {
+      succ[n] += c.succ[n];
+      fail[n] += c.fail[n];
+    }
+    return *this;
+  }
+  LogProb logBernoulli (const BernoulliLogParams& logParams) const {
+    LogProb lp = 0;
+    for (int n = 0; n < N; ++n) {
+      if (succ[n] != 0)
+	lp += succ[n] * logParams.logSucc[n];
+      if (fail[n] != 0)
+	lp += fail[n] * logParams.logFail[n];
+    }
+    return lp;
+  }
+  operator BernoulliCounts() const;
+};
+
 class BernoulliCounts {
 public:
   vguard<double> succ, fail;
@@ -23,25 +63,72 @@ public:
 
   LogProb logBetaBernoulli (const BernoulliCounts& prior) const;
   LogProb deltaLogBetaBernoulli (const BernoulliCounts& old) const;
+  LogProb logBernoulli (const BernoulliLogParams& logParams) const;
 
+  template<int N>
+  LogProb deltaLogBetaBernoulli (const FixedBernoulliCounts<N>& delta) const {
+    LogProb lp = 0;
+    for (int n = 0; n < N; ++n)
+      if (delta.succ[n] != 0 || delta.fail[n] != 0)
+	lp += ::deltaLogBetaBernoulli (succ[n], fail[n], delta.succ[n], delta.fail[n]);
+    return lp;
+  }
+
+  // batched, for deltas that are BernoulliCounts or FixedBernoulliCounts: shares the current log-beta terms
+  template<class Counts>
+  vguard<LogProb> deltaLogBetaBernoulli (const vguard<Counts>& deltas) const {
+    vguard<LogProb> current (nParams());
+    for (int n = 0; n < (int) nParams(); ++n)
+      current[n] = logBeta (succ[n] + 1, fail[n] + 1);
+    vguard<LogProb> lp (deltas.size(), 0);
+    for (size_t d = 0; d < deltas.size(); ++d) {
+      const Counts& delta = deltas[d];
+      for (int n = 0; n < (int) delta.nParams(); ++n)
+	if (delta.succ[n] != 0 || delta.fail[n] != 0)
+	  lp[d] += logBeta (succ[n] + delta.succ[n] + 1, fail[n] + delta.fail[n] + 1) - current[n];
+    }
+    return lp;
+  }
+
+  // samples from the Beta(succ+1,fail+1) posterior of each parameter
   template<class Generator>
   BernoulliParams sampleParams (Generator& generator) const {
     BernoulliParams p (nParams());
     for (BernoulliParamIndex i = 0; i < nParams(); ++i) {
-      gamma_distribution<double> gamma (succ[i] + 1, fail[i] + 1);
-      p[i] = gamma (generator);
+      gamma_distribution<double> succGamma (succ[i] + 1, 1), failGamma (fail[i] + 1, 1);
+      const double s = succGamma (generator), f = failGamma (generator);
+      p[i] = s / (s + f);
     }
     return p;
   }
 
   BernoulliCounts& operator+= (const BernoulliCounts& c);
 
+  template<int N>
+  BernoulliCounts& operator+= (const FixedBernoulliCounts<N>& c) {
+    for (int n = 0; n < N; ++n) {
+      succ[n] += c.succ[n];
+      fail[n] += c.fail[n];
+    }
+    return *this;
+  }
+
   string toJSON (const vguard<BernoulliParamName>& params) const;
   
 private:
   static string countsToJSON (const vguard<BernoulliParamName>& params, const vguard<double>& c);
 };
 
+template<int N>
+FixedBernoulliCounts<N>::operator BernoulliCounts() const {
+  BernoulliCounts c (N);
+  for (int n = 0; n < N; ++n) {
+    c.succ[n] = succ[n];
+    c.fail[n] = fail[n];
+  }
+  return c;
+}
+
 struct BernoulliParamSet {
   vguard<BernoulliParamName> paramName;
   map<BernoulliParamName,BernoulliParamIndex> paramIndex;
@@ -0,0 +1,91 @@
+#ifndef BINIO_INCLUDED
+#define BINIO_INCLUDED
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include "vguard.h"
+
+using namespace std;
+
+// FNV-1a: unlike std::hash, the same for every build & platform, so it can be saved in files
+inline uint64_t fnv1a_hash (const string& s) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// binary files (indices, partial results) are a magic string followed by
+// sizes, strings & arrays in native byte order
+inline void writeMagic (ostream& out, const char* magic) {
+  out.write (magic, strlen (magic));
+}
+
+inline void readMagic (istream& in, const char* magic, const char* fileType) {
+  string s (strlen (magic), '\0');
+  in.read (&s[0], s.size());
+  if (!in || s != magic)
+    throw runtime_error (string("Not a ") + fileType + " file");
+}
+
+inline void writeSize (ostream& out, uint64_t n) {
+  out.write ((const char*) &n, sizeof(n));
+}
+
+inline uint64_t readSize (istream& in) {
+  uint64_t n;
+  in.read ((char*) &n, sizeof(n));
+  if (!in)
+    throw runtime_error ("Binary file is truncated");
+  return n;
+}
+
+inline void writeString (ostream& out, const string& s) {
+  writeSize (out, s.size());
+  out.write (s.data(), s.size());
+}
+
+inline string readString (istream& in) {
+  string s (readSize (in), '\0');
+  in.read (&s[0], s.size());
+  if (!in)
+    throw runtime_error ("Binary file is truncated");
+  return s;
+}
+
+template<class T,class Container>
+inline void writeArray (ostream& out, const Container& c) {
+  const vguard<T> v (c.begin(), c.end());
+  writeSize (out, v.size());
+  out.write ((const char*) v.data(), v.size() * sizeof(T));
+}
+
+template<class T>
+inline vguard<T> readArray (istream& in) {
+  vguard<T> v (readSize (in));
+  in.read ((char*) v.data(), v.size() * sizeof(T));
+  if (!in)
+    throw runtime_error ("Binary file is truncated");
+  return v;
+}
+
+template<class Container>
+inline void writeStrings (ostream& out, const Container& c) {
+  writeSize (out, c.size());
+  for (const auto& s : c)
+    writeString (out, s);
+}
+
+inline vguard<string> readStrings (istream& in) {
+  vguard<string> v (readSize (in));
+  for (auto& s : v)
+    s = readString (in);
+  return v;
+}
+
+#endif /* BINIO_INCLUDED */
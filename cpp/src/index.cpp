@@ -0,0 +1,420 @@
+#include <deque>
+#include "index.h"
+#include "binio.h"
+
+const char* index_magic = "wtfgenes-index-1";
+
+AssocsIndex::Diff::Diff()
+  : addedGenes(0), removedGenes(0), addedAssocs(0), removedAssocs(0),
+    closureTermsRecomputed(0), genesReindexed(0), termsReindexed(0), equivClassTermsRecomputed(0)
+{ }
+
+string AssocsIndex::Diff::toJSON() const {
+  auto termsJSON = [] (const set<TermName>& terms) -> string {
+    list<string> quoted;
+    for (auto& t : terms)
+      quoted.push_back (string("\"") + t + "\"");
+    return string("[") + join(quoted,",") + "]";
+  };
+  ostringstream json;
+  json << "{\"addedTerms\":" << termsJSON(addedTerms)
+       << ",\"removedTerms\":" << termsJSON(removedTerms)
+       << ",\"obsoletedTerms\":" << termsJSON(obsoletedTerms)
+       << ",\"reparentedTerms\":" << termsJSON(reparentedTerms)
+       << ",\"addedGenes\":" << addedGenes
+       << ",\"removedGenes\":" << removedGenes
+       << ",\"addedAssocs\":" << addedAssocs
+       << ",\"removedAssocs\":" << removedAssocs
+       << ",\"recomputed\":{\"closureTerms\":" << closureTermsRecomputed
+       << ",\"genes\":" << genesReindexed
+       << ",\"genesByTerm\":" << termsReindexed
+       << ",\"equivClassTerms\":" << equivClassTermsRecomputed
+       << "}}";
+  return json.str();
+}
+
+void AssocsIndex::setOntology (const Ontology& ontology) {
+  if (!ontology.prunedTermAncestors.empty())
+    throw logic_error ("Can't index a pruned ontology");
+  termName = ontology.termName;
+  parents = ontology.parents;
+  termNamespace = ontology.termNamespace;
+  obsoleteTerms = ontology.obsoleteTerms;
+}
+
+// each gene's annotations, & the genes in order of appearance
+static void groupByGene (const Assocs::GeneTermList& geneTermList, map<Assocs::GeneName,vguard<Ontology::TermName> >& directTerms, vguard<Assocs::GeneName>& geneOrder) {
+  for (auto& gt : geneTermList) {
+    auto iter = directTerms.find (gt.first);
+    if (iter == directTerms.end()) {
+      geneOrder.push_back (gt.first);
+      iter = directTerms.insert (make_pair (gt.first, vguard<Ontology::TermName>())).first;
+    }
+    iter->second.push_back (gt.second);
+  }
+}
+
+void AssocsIndex::build (const Ontology& ontology, const Assocs::GeneTermList& geneTermList, size_t nThreads) {
+  setOntology (ontology);
+  closure = ontology.transitiveClosure (nThreads);
+  Assocs assocs (ontology);
+  assocs.nThreads = nThreads;
+  assocs.init (geneTermList, closure);
+  geneName = assocs.geneName;
+  genesByTerm = assocs.genesByTerm;
+  termsInEquivClass = assocs.termsInEquivClass;
+  nAssocs = assocs.nAssocs;
+  geneDirectTerms = vguard<vguard<TermName> > (geneName.size());
+  for (auto& gt : geneTermList)
+    geneDirectTerms[assocs.geneIndex.at(gt.first)].push_back (gt.second);
+}
+
+AssocsIndex::Diff AssocsIndex::update (const AssocsIndex& previous, const Ontology& ontology, const Assocs::GeneTermList& geneTermList) {
+  Diff diff;
+  setOntology (ontology);
+  const TermIndex nTerms = ontology.terms(), nPrevTerms = previous.termName.size();
+
+  // match terms by name
+  map<TermName,TermIndex> prevTermIndex;
+  for (TermIndex pt = 0; pt < nPrevTerms; ++pt)
+    prevTermIndex[previous.termName[pt]] = pt;
+  vguard<TermIndex> prevTerm (nTerms, -1), newTerm (nPrevTerms, -1);
+  for (TermIndex t = 0; t < nTerms; ++t) {
+    auto iter = prevTermIndex.find (termName[t]);
+    if (iter != prevTermIndex.end()) {
+      prevTerm[t] = iter->second;
+      newTerm[iter->second] = t;
+    }
+  }
+  for (TermIndex pt = 0; pt < nPrevTerms; ++pt)
+    if (newTerm[pt] < 0)
+      (obsoleteTerms.count(previous.termName[pt]) ? diff.obsoletedTerms : diff.removedTerms).insert (previous.termName[pt]);
+
+  // a term's closure changes if it is new, its parents changed, or the same is true of an ancestor
+  vguard<bool> closureChanged (nTerms, false);
+  deque<TermIndex> queue;
+  for (TermIndex t = 0; t < nTerms; ++t) {
+    bool changed = false;
+    if (prevTerm[t] < 0) {
+      diff.addedTerms.insert (termName[t]);
+      changed = true;
+    } else {
+      vguard<TermIndex> prevParents;
+      for (auto pp : previous.parents[prevTerm[t]])
+	prevParents.push_back (newTerm[pp]);
+      vguard<TermIndex> newParents (parents[t]);
+      sort (prevParents.begin(), prevParents.end());
+      sort (newParents.begin(), newParents.end());
+      if (prevParents != newParents) {
+	diff.reparentedTerms.insert (termName[t]);
+	changed = true;
+      }
+    }
+    if (changed) {
+      closureChanged[t] = true;
+      queue.push_back (t);
+    }
+  }
+  while (queue.size()) {
+    const TermIndex t = queue.front();
+    queue.pop_front();
+    for (auto c : ontology.children[t])
+      if (!closureChanged[c]) {
+	closureChanged[c] = true;
+	queue.push_back (c);
+      }
+  }
+
+  // unchanged closures are renumbered, since all their terms survive; the rest are recomputed parents first
+  closure = vguard<set<TermIndex> > (nTerms);
+  const vguard<TermIndex> toposort = ontology.toposortTermIndex();
+  for (TermIndex t : toposort)
+    if (closureChanged[t]) {
+      closure[t].insert (t);
+      for (auto p : parents[t])
+	closure[t].insert (closure[p].begin(), closure[p].end());
+      ++diff.closureTermsRecomputed;
+    } else
+      for (auto pa : previous.closure[prevTerm[t]])
+	closure[t].insert (newTerm[pa]);
+
+  // genes are numbered in order of appearance, as Assocs::init numbers them,
+  // so the updated index is identical to one built from scratch
+  map<GeneName,vguard<TermName> > directTerms;
+  vguard<GeneName> geneOrder;
+  groupByGene (geneTermList, directTerms, geneOrder);
+  map<GeneName,GeneIndex> prevGeneIndex;
+  for (GeneIndex pg = 0; pg < (GeneIndex) previous.geneName.size(); ++pg)
+    prevGeneIndex[previous.geneName[pg]] = pg;
+  vguard<GeneIndex> prevGene, newGene (previous.geneName.size(), -1);
+  geneName.clear();
+  geneDirectTerms.clear();
+  auto addGene = [&] (const GeneName& name, GeneIndex pg) {
+    if (pg >= 0)
+      newGene[pg] = geneName.size();
+    prevGene.push_back (pg);
+    geneName.push_back (name);
+    geneDirectTerms.push_back (vguard<TermName>());
+    geneDirectTerms.back().swap (directTerms.at (name));
+  };
+  for (auto& name : geneOrder) {
+    auto iter = prevGeneIndex.find (name);
+    if (iter == prevGeneIndex.end()) {
+      addGene (name, -1);
+      ++diff.addedGenes;
+    } else
+      addGene (name, iter->second);
+  }
+  for (auto g : newGene)
+    if (g < 0)
+      ++diff.removedGenes;
+  const GeneIndex nGenes = geneName.size();
+
+  // a gene's terms change if its annotations did, or the closure of one of its annotated terms did
+  auto termIndex = [&] (const TermName& tn) -> TermIndex {
+    auto iter = ontology.termIndex.find (tn);
+    return iter == ontology.termIndex.end() ? -1 : iter->second;
+  };
+  vguard<bool> geneChanged (nGenes, false);
+  for (GeneIndex g = 0; g < nGenes; ++g) {
+    if (prevGene[g] < 0 || geneDirectTerms[g] != previous.geneDirectTerms[prevGene[g]])
+      geneChanged[g] = true;
+    else
+      for (auto& tn : geneDirectTerms[g]) {
+	const TermIndex t = termIndex (tn);
+	if (t < 0 ? prevTermIndex.count(tn) > 0 : closureChanged[t]) {
+	  geneChanged[g] = true;
+	  break;
+	}
+      }
+  }
+
+  // terms (in the new numbering) & association count of a gene in either release
+  set<TermName> missing;
+  auto prevGeneTerms = [&] (GeneIndex pg, int& count) -> set<TermIndex> {
+    set<TermIndex> terms;
+    for (auto& tn : previous.geneDirectTerms[pg]) {
+      auto iter = prevTermIndex.find (tn);
+      if (iter != prevTermIndex.end()) {
+	const set<TermIndex>& c = previous.closure[iter->second];
+	count += c.size();
+	for (auto pt : c)
+	  if (newTerm[pt] >= 0)
+	    terms.insert (newTerm[pt]);
+      }
+    }
+    return terms;
+  };
+  auto newGeneTerms = [&] (GeneIndex g, int& count) -> set<TermIndex> {
+    set<TermIndex> terms;
+    for (auto& tn : geneDirectTerms[g]) {
+      const TermIndex t = termIndex (tn);
+      if (t >= 0) {
+	count += closure[t].size();
+	terms.insert (closure[t].begin(), closure[t].end());
+      } else
+	missing.insert (tn);
+    }
+    return terms;
+  };
+  auto uniqueTerms = [] (const vguard<TermName>& direct) -> set<TermName> {
+    return set<TermName> (direct.begin(), direct.end());
+  };
+
+  // renumber (& re-sort) the previous gene lists, then apply the changed genes' edits
+  genesByTerm = vguard<vguard<GeneIndex> > (nTerms);
+  vguard<bool> termChanged (nTerms, false);
+  for (TermIndex t = 0; t < nTerms; ++t)
+    if (prevTerm[t] >= 0) {
+      vguard<GeneIndex>& gbt = genesByTerm[t];
+      for (auto pg : previous.genesByTerm[prevTerm[t]])
+	if (newGene[pg] >= 0)
+	  gbt.push_back (newGene[pg]);
+	else
+	  termChanged[t] = true;
+      sort (gbt.begin(), gbt.end());
+    } else
+      termChanged[t] = true;
+
+  int prevCount = 0, newCount = 0;
+  for (GeneIndex pg = 0; pg < (GeneIndex) previous.geneName.size(); ++pg)
+    if (newGene[pg] < 0) {
+      prevGeneTerms (pg, prevCount);
+      diff.removedAssocs += uniqueTerms(previous.geneDirectTerms[pg]).size();
+    }
+  vguard<vguard<GeneIndex> > genesRemoved (nTerms), genesAdded (nTerms);
+  for (GeneIndex g = 0; g < nGenes; ++g)
+    if (geneChanged[g]) {
+      ++diff.genesReindexed;
+      const set<TermIndex> prevTerms = prevGene[g] >= 0 ? prevGeneTerms (prevGene[g], prevCount) : set<TermIndex>(),
+	newTerms = newGeneTerms (g, newCount);
+      for (auto t : prevTerms)
+	if (!newTerms.count(t))
+	  genesRemoved[t].push_back (g);
+      for (auto t : newTerms)
+	if (!prevTerms.count(t))
+	  genesAdded[t].push_back (g);
+      const set<TermName> newDirect = uniqueTerms (geneDirectTerms[g]),
+	prevDirect = prevGene[g] >= 0 ? uniqueTerms (previous.geneDirectTerms[prevGene[g]]) : set<TermName>();
+      for (auto& tn : newDirect)
+	if (!prevDirect.count(tn))
+	  ++diff.addedAssocs;
+      for (auto& tn : prevDirect)
+	if (!newDirect.count(tn))
+	  ++diff.removedAssocs;
+    }
+  nAssocs = previous.nAssocs - prevCount + newCount;
+  if (missing.size())
+    Warn ("Terms not found in the ontology: %s", join(missing).c_str());
+
+  for (TermIndex t = 0; t < nTerms; ++t) {
+    vguard<GeneIndex>& gbt = genesByTerm[t];
+    if (genesRemoved[t].size()) {
+      vector<GeneIndex> kept;
+      set_difference (gbt.begin(), gbt.end(), genesRemoved[t].begin(), genesRemoved[t].end(), back_inserter (kept));
+      gbt = vguard<GeneIndex> (kept.begin(), kept.end());
+    }
+    if (genesAdded[t].size()) {
+      const size_t nOld = gbt.size();
+      gbt.insert (gbt.end(), genesAdded[t].begin(), genesAdded[t].end());
+      inplace_merge (gbt.begin(), gbt.begin() + nOld, gbt.end());
+    }
+    if (genesRemoved[t].size() || genesAdded[t].size())
+      termChanged[t] = true;
+    if (termChanged[t])
+      ++diff.termsReindexed;
+  }
+
+  // unchanged terms keep their previous classes, which may gain changed terms with the same genes.
+  // classes are then numbered as Assocs::init would, by first member in reverse toposort order
+  vguard<int> prevClass (nPrevTerms);
+  for (size_t c = 0; c < previous.termsInEquivClass.size(); ++c)
+    for (auto pt : previous.termsInEquivClass[c])
+      prevClass[pt] = c;
+  map<vguard<GeneIndex>,int> changedLabel;
+  for (TermIndex t = 0; t < nTerms; ++t)
+    if (termChanged[t])
+      changedLabel[genesByTerm[t]] = -1;
+  vguard<int> label (nTerms);
+  vguard<bool> classSeen (previous.termsInEquivClass.size(), false);
+  for (TermIndex t = 0; t < nTerms; ++t)
+    if (!termChanged[t]) {
+      const int c = prevClass[prevTerm[t]];
+      label[t] = c;
+      if (!classSeen[c] && changedLabel.size()) {
+	auto iter = changedLabel.find (genesByTerm[t]);
+	if (iter != changedLabel.end())
+	  iter->second = c;
+      }
+      classSeen[c] = true;
+    }
+  int nLabels = previous.termsInEquivClass.size();
+  for (TermIndex t = 0; t < nTerms; ++t)
+    if (termChanged[t]) {
+      int& l = changedLabel[genesByTerm[t]];
+      if (l < 0)
+	l = nLabels++;
+      label[t] = l;
+      ++diff.equivClassTermsRecomputed;
+    }
+  vguard<int> labelClass (nLabels, -1);
+  termsInEquivClass.clear();
+  for (auto iter = toposort.rbegin(); iter != toposort.rend(); ++iter) {
+    int& c = labelClass[label[*iter]];
+    if (c < 0) {
+      c = termsInEquivClass.size();
+      termsInEquivClass.push_back (vguard<TermIndex>());
+    }
+    termsInEquivClass[c].push_back (*iter);
+  }
+
+  return diff;
+}
+
+void AssocsIndex::initOntology (Ontology& ontology) const {
+  ontology.termName = termName;
+  ontology.parents = parents;
+  ontology.termNamespace = termNamespace;
+  ontology.obsoleteTerms = obsoleteTerms;
+  ontology.termIndex.clear();
+  ontology.children = vguard<vguard<TermIndex> > (termName.size());
+  // children are listed in term order, as Ontology::init does
+  for (TermIndex t = 0; t < (TermIndex) termName.size(); ++t) {
+    ontology.termIndex[termName[t]] = t;
+    for (auto p : parents[t])
+      ontology.children[p].push_back (t);
+  }
+}
+
+void AssocsIndex::initAssocs (Assocs& assocs) const {
+  Assert (assocs.terms() == (TermIndex) termName.size() && assocs.genes() == 0, "Assocs must be empty, on the indexed ontology");
+  assocs.geneName = geneName;
+  for (GeneIndex g = 0; g < (GeneIndex) geneName.size(); ++g)
+    assocs.geneIndex[geneName[g]] = g;
+  assocs.genesByTerm = genesByTerm;
+  assocs.termsByGene = vguard<set<TermIndex> > (geneName.size());
+  for (TermIndex t = 0; t < (TermIndex) genesByTerm.size(); ++t)
+    for (auto g : genesByTerm[t])
+      assocs.termsByGene[g].insert (assocs.termsByGene[g].end(), t);
+  assocs.termsInEquivClass = termsInEquivClass;
+  for (size_t c = 0; c < termsInEquivClass.size(); ++c)
+    for (auto t : termsInEquivClass[c])
+      assocs.equivClassByTerm[t] = c;
+  assocs.nAssocs = nAssocs;
+}
+
+void AssocsIndex::write (ostream& out) const {
+  writeMagic (out, index_magic);
+  writeStrings (out, termName);
+  writeSize (out, parents.size());
+  for (auto& p : parents)
+    writeArray<int> (out, p);
+  writeSize (out, termNamespace.size());
+  for (auto& tn : termNamespace) {
+    writeString (out, tn.first);
+    writeString (out, tn.second);
+  }
+  writeStrings (out, obsoleteTerms);
+  for (auto& c : closure)
+    writeArray<int> (out, c);
+  writeStrings (out, geneName);
+  for (auto& d : geneDirectTerms)
+    writeStrings (out, d);
+  for (auto& gbt : genesByTerm)
+    writeArray<int> (out, gbt);
+  writeSize (out, termsInEquivClass.size());
+  for (auto& ec : termsInEquivClass)
+    writeArray<int> (out, ec);
+  writeSize (out, nAssocs);
+}
+
+void AssocsIndex::read (istream& in) {
+  readMagic (in, index_magic, "wtfgenes index");
+  termName = readStrings (in);
+  parents = vguard<vguard<TermIndex> > (readSize (in));
+  for (auto& p : parents)
+    p = readArray<int> (in);
+  termNamespace.clear();
+  for (size_t n = readSize (in); n > 0; --n) {
+    const TermName tn = readString (in);
+    termNamespace[tn] = readString (in);
+  }
+  const vguard<string> obsolete = readStrings (in);
+  obsoleteTerms = set<TermName> (obsolete.begin(), obsolete.end());
+  closure = vguard<set<TermIndex> > (termName.size());
+  for (auto& c : closure) {
+    const vguard<int> v = readArray<int> (in);
+    c = set<TermIndex> (v.begin(), v.end());
+  }
+  geneName = readStrings (in);
+  geneDirectTerms = vguard<vguard<TermName> > (geneName.size());
+  for (auto& d : geneDirectTerms)
+    d = readStrings (in);
+  genesByTerm = vguard<vguard<GeneIndex> > (termName.size());
+  for (auto& gbt : genesByTerm)
+    gbt = readArray<int> (in);
+  termsInEquivClass = vguard<vguard<TermIndex> > (readSize (in));
+  for (auto& ec : termsInEquivClass)
+    ec = readArray<int> (in);
+  nAssocs = readSize (in);
+}
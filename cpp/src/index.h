@@ -0,0 +1,58 @@
+#ifndef INDEX_INCLUDED
+#define INDEX_INCLUDED
+
+#include "ontology.h"
+#include "assocs.h"
+
+// Binary index of an ontology & its gene-term associations.
+// Besides the tables that Ontology & Assocs need, it keeps each gene's direct annotations
+// & the transitive closure, so that the next release can be diffed against it,
+// recomputing only the affected parts of the closure, genesByTerm & the equivalence classes
+struct AssocsIndex {
+  typedef Ontology::TermName TermName;
+  typedef Ontology::TermIndex TermIndex;
+  typedef Assocs::GeneName GeneName;
+  typedef Assocs::GeneIndex GeneIndex;
+
+  // the ontology, exactly as numbered by Ontology::init
+  vguard<TermName> termName;
+  vguard<vguard<TermIndex> > parents;
+  map<TermName,string> termNamespace;
+  set<TermName> obsoleteTerms;
+
+  vguard<set<TermIndex> > closure;  // indexed by TermIndex
+
+  vguard<GeneName> geneName;
+  vguard<vguard<TermName> > geneDirectTerms;  // indexed by GeneIndex; annotations as they appear in the GAF
+  vguard<vguard<GeneIndex> > genesByTerm;  // indexed by TermIndex
+  vguard<vguard<TermIndex> > termsInEquivClass;
+  int nAssocs;
+
+  // what changed between two releases, & how much of the index had to be recomputed
+  struct Diff {
+    set<TermName> addedTerms, removedTerms, obsoletedTerms, reparentedTerms;
+    size_t addedGenes, removedGenes, addedAssocs, removedAssocs;
+    size_t closureTermsRecomputed, genesReindexed, termsReindexed, equivClassTermsRecomputed;
+    Diff();
+    string toJSON() const;
+  };
+
+  AssocsIndex() : nAssocs(0) { }
+
+  // build from scratch, for an unpruned ontology
+  void build (const Ontology& ontology, const Assocs::GeneTermList& geneTermList, size_t nThreads = 1);
+  // build for a new release of the ontology & annotations, starting from the previous release's index
+  Diff update (const AssocsIndex& previous, const Ontology& ontology, const Assocs::GeneTermList& geneTermList);
+
+  // fill an empty Ontology, then an Assocs constructed on it
+  void initOntology (Ontology& ontology) const;
+  void initAssocs (Assocs& assocs) const;
+
+  void write (ostream& out) const;
+  void read (istream& in);
+
+private:
+  void setOntology (const Ontology& ontology);
+};
+
+#endif /* INDEX_INCLUDED */
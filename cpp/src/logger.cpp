@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <math.h>
+#include <sys/resource.h>
 #include "logger.h"
 #include "regexmacros.h"
 
@@ -210,3 +211,58 @@ void ProgressLogger::logProgress (double completedFraction, const char* desc, ..
     reportInterval = fmin (10., 2*reportInterval);
   }
 }
+
+PhaseTimer::Stamp PhaseTimer::now() {
+  Stamp stamp;
+  stamp.wall = Clock::now();
+  stamp.cpuSeconds = cpuSeconds();
+  return stamp;
+}
+
+double PhaseTimer::cpuSeconds() {
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+size_t PhaseTimer::peakRssBytes() {
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss;  // bytes on macOS
+#else
+  return usage.ru_maxrss * 1024;  // kilobytes on Linux
+#endif
+}
+
+double PhaseTimer::add (const string& phase, const Stamp& start) {
+  Phase p;
+  p.name = phase;
+  p.wallSeconds = std::chrono::duration<double> (Clock::now() - start.wall).count();
+  p.cpuSeconds = cpuSeconds() - start.cpuSeconds;
+  p.peakRssBytes = peakRssBytes();
+  lock_guard<mutex> lock (mx);
+  phases.push_back (p);
+  LogAt(verbosity,"Phase '" << phase << "' took " << p.wallSeconds << " seconds (" << p.cpuSeconds << " CPU seconds)" << endl);
+  return p.wallSeconds;
+}
+
+string PhaseTimer::toString() const {
+  list<string> s;
+  for (auto& p : phases) {
+    ostringstream l;
+    l << p.name << " " << p.wallSeconds << "s";
+    s.push_back (l.str());
+  }
+  return join (s, ", ");
+}
+
+string PhaseTimer::toJSON() const {
+  list<string> s;
+  for (auto& p : phases) {
+    ostringstream l;
+    l << "{\"phase\":\"" << p.name << "\",\"wallSeconds\":" << p.wallSeconds << ",\"cpuSeconds\":" << p.cpuSeconds << ",\"peakRssBytes\":" << p.peakRssBytes << "}";
+    s.push_back (l.str());
+  }
+  return string("[") + join (s, ",") + "]";
+}
@@ -104,5 +104,36 @@ private:
 
 #define ProgressLog(PLOG,V) ProgressLogger PLOG (V, __func__, __FILE__, __LINE__)
 
+/* phase timing.
+   Records the wall-clock & CPU seconds of named phases, and the peak resident set size at the end of each.
+   Phases may overlap (e.g. on different threads), in which case CPU time is shared between them,
+   since it is measured for the whole process. add() is thread-safe, and logs each phase as it completes */
+class PhaseTimer {
+public:
+  typedef std::chrono::steady_clock Clock;
+  struct Stamp {
+    Clock::time_point wall;
+    double cpuSeconds;
+  };
+  struct Phase {
+    string name;
+    double wallSeconds, cpuSeconds;
+    size_t peakRssBytes;
+  };
+  vguard<Phase> phases;
+  int verbosity;
+  PhaseTimer (int verbosity = 2) : verbosity(verbosity) { }
+  static Stamp now();
+  static double cpuSeconds();  // user + system time of this process
+  static size_t peakRssBytes();
+  double add (const string& phase, const Stamp& start);  // returns wall-clock seconds since start
+  string toString() const;
+  string toJSON() const;
+private:
+  mutex mx;
+  PhaseTimer (const PhaseTimer&) = delete;
+  PhaseTimer& operator= (const PhaseTimer&) = delete;
+};
+
 #endif /* LOGGER_INCLUDED */
 
@@ -1,21 +1,67 @@
 #include "mcmc.h"
 #include "logger.h"
+#include "binio.h"
 
 void MCMC::initModels (const vguard<Assocs::GeneNameSet>& geneNameSets) {
-  models.reserve (models.size() + geneSets.size());
-  for (auto& gs : geneNameSets) {
+  const size_t firstModel = models.size();
+  models.reserve (firstModel + geneNameSets.size());
+  for (size_t n = 0; n < geneNameSets.size(); ++n)
     models.push_back (Model (assocs, parameterization));
-    models.back().init (gs);
-    geneSets.push_back (models.back().geneSet);
-    const size_t vars = models.back().relevantTerms.size();
+
+  // models are independent, so can be initialized in parallel
+  auto initRange = [&] (size_t first) {
+    for (size_t n = first; n < geneNameSets.size(); n += nThreads)
+      models[firstModel + n].init (geneNameSets[n]);
+  };
+  if (nThreads > 1 && geneNameSets.size() > 1) {
+    list<thread> threads;
+    for (size_t t = 0; t < nThreads; ++t)
+      threads.push_back (thread (initRange, t));
+    for (auto& thr: threads)
+      thr.join();
+  } else
+    initRange (0);
+
+  for (ModelIndex m = firstModel; m < models.size(); ++m) {
+    geneSets.push_back (models[m].geneSet);
+    const size_t vars = models[m].relevantTerms.size();
     modelWeight.push_back (vars);
     nVariables += vars;
-    termStateOccupancy.push_back (vguard<int> (assocs.terms()));
-    geneFalseOccupancy.push_back (vguard<int> (assocs.genes()));
   }
   countsWithPrior = computeCountsWithPrior();
 }
 
+void MCMC::setInitialTerms (ModelIndex m, const vguard<TermName>& termNames) {
+  Model& model = models[m];
+  for (auto& tn : termNames) {
+    auto iter = assocs.ontology.termIndex.find (tn);
+    if (iter == assocs.ontology.termIndex.end()) {
+      if (!assocs.ontology.isPruned (tn))
+	Warn ("Initial term %s not found in the ontology", tn.c_str());
+    }
+    else if (model.isRelevant (iter->second))
+      model.setTermState (iter->second, true);
+  }
+  countsWithPrior = computeCountsWithPrior();
+}
+
+void MCMC::updateGeneSet (ModelIndex m, const Assocs::GeneNameSet& geneNames) {
+  Model& model = models[m];
+  nVariables -= model.relevantTerms.size();
+  model.updateGeneSet (geneNames);
+  geneSets[m] = model.geneSet;
+  modelWeight[m] = model.relevantTerms.size();
+  nVariables += model.relevantTerms.size();
+  countsWithPrior = computeCountsWithPrior();
+  resetSamples();
+}
+
+void MCMC::resetSamples() {
+  samples = samplesIncludingBurn = conditionalSamples = 0;
+  for (auto& model : models)
+    model.resetOccupancy();
+}
+
 BernoulliCounts MCMC::computeCounts() const {
   BernoulliCounts c;
   for (auto& m : models)
@@ -35,69 +81,643 @@ LogProb MCMC::collapsedLogLikelihood() const {
 }
 
 void MCMC::run (size_t nSamples, RandomGenerator& generator) {
-  if (accumulate (modelWeight.begin(), modelWeight.end(), 0) <= 0) {
+  if (nVariables == 0) {
     Warn ("Refusing to run MCMC on a model with no variables");
     return;
   }
 
+  initSamplers();
+
   ProgressLog (plog, 1);
   plog.initProgress ("MCMC sampling run (%u models, %u variables)", models.size(), nVariables);
 
+  startRunTimer();
   for (size_t sample = 0; sample < nSamples; ++sample) {
-
     plog.logProgress (sample / (double) (nSamples - 1), "sample %u/%u", sample + 1, nSamples);
+    step (sample, nSamples, generator);
+    updateRunTimer();
+  }
+  stopRunTimer();
+}
 
-    Move move;
-    move.samples = sample;
-    move.totalSamples = nSamples;
-    move.type = (MoveType) random_index (moveRate, generator);
-    move.propose (models, modelWeight, generator);
-    move.model->sampleMoveCollapsed (move, countsWithPrior, generator);
+LogProb MCMC::searchMAP (MapMethod method, size_t nSteps, size_t nRestarts, RandomGenerator& generator, double annealFrom, double annealTo) {
+  initSamplers();
+  const bool wasRecording = recordSamples;
+  const double wasInverseTemperature = inverseTemperature;
+  recordSamples = false;
 
-    LogThisAt(2,"Move #" << (samplesIncludingBurn+1) << ": " << move.toJSON() << endl);
-    
-    ++samplesIncludingBurn;
-    if (finishedBurn()) {
-      ++samples;
+  LogProb bestLogLike = -numeric_limits<double>::infinity();
+  vguard<set<TermIndex> > bestTerms;
+  auto keepBest = [&] () {
+    const LogProb logLike = currentLogLikelihood();
+    if (logLike > bestLogLike) {
+      bestLogLike = logLike;
+      bestTerms.clear();
+      for (auto& model : models)
+	bestTerms.push_back (model.activeTerms());
+    }
+  };
+  // random restarts switch on about two terms per model, since the posterior typically has few
+  auto setTerms = [&] (function<bool(ModelIndex,TermIndex)> isActive) {
+    for (ModelIndex m = 0; m < models.size(); ++m) {
+      Model::TermStateAssignment tsa;
+      for (auto t : models[m].relevantTerms)
+	tsa[t] = isActive (m, t);
+      models[m].occupancyClock = samples;
+      models[m].setTermStates (tsa);
+    }
+    countsWithPrior = computeCountsWithPrior();
+  };
 
-      for (ModelIndex n = 0; n < models.size(); ++n) {
-	Model& model = models[n];
-	for (auto t: model.activeTerms())
-	  ++termStateOccupancy[n][t];
-	for (auto g: model.falseGenes())
-	  ++geneFalseOccupancy[n][g];
+  for (size_t restart = 0; restart < nRestarts; ++restart) {
+    if (restart > 0)
+      setTerms ([&] (ModelIndex m, TermIndex) { return random_double(generator) * models[m].relevantTerms.size() < 2; });
+    keepBest();
+    for (size_t s = 0; s < nSteps; ++s) {
+      if (method == Anneal) {
+	inverseTemperature = annealFrom * pow (annealTo / annealFrom, s / (double) max (nSteps - 1, (size_t) 1));
+	step (s, nSteps, generator);
+	keepBest();
+      } else {
+	Move move;
+	move.type = (MoveType) moveSampler.sample (generator);
+	if (move.type == Model::MultipleTry)
+	  move.type = multipleTryType;
+	move.propose (models, modelSampler, generator);
+	const BernoulliCounts delta = move.model->getCountDelta (move.termStates);
+	move.accepted = countsWithPrior.deltaLogBetaBernoulli (delta) > 0;
+	if (move.accepted) {
+	  move.model->occupancyClock = samples;
+	  move.model->setTermStates (move.termStates);
+	  countsWithPrior += delta;
+	}
+	++movesProposed[move.type];
+	if (move.accepted)
+	  ++movesAccepted[move.type];
       }
     }
+    keepBest();
+    LogThisAt(2,"MAP search restart #" << (restart+1) << ": best log-likelihood " << bestLogLike << endl);
   }
+
+  setTerms ([&] (ModelIndex m, TermIndex t) { return bestTerms[m].count(t) > 0; });
+  recordSamples = wasRecording;
+  inverseTemperature = wasInverseTemperature;
+  return bestLogLike;
 }
 
-MCMC::Summary MCMC::summary (double postProbThreshold, double pValueThreshold) const {
+MCMC::Summary MCMC::stateSummary (double pValueThreshold) const {
   Summary summ;
   summ.params = params;
   summ.prior = prior;
   summ.moveRate = moveRate;
   const auto equiv = assocs.termEquivalents();
   for (ModelIndex m = 0; m < models.size(); ++m) {
-    auto& model = models[m];
+    const Model& model = models[m];
     GeneSetSummary gss;
-    for (auto t: model.relevantTerms) {
-      const double p = termStateOccupancy[m][t] / (double) samples;
-      if (p >= postProbThreshold) {
-	auto& tn = assocs.ontology.termName[t];
-	gss.termPosterior[tn] = p;
-	if (equiv.count(tn) && !summ.termEquivalents.count(tn))
-	  summ.termEquivalents[tn] = equiv.at(tn);
+    for (auto t : model.activeTerms()) {
+      const TermName& tn = assocs.ontology.termName[t];
+      gss.termPosterior[tn] = 1;
+      if (equiv.count(tn))
+	summ.termEquivalents[tn] = equiv.at(tn);
+    }
+    for (auto g : model.falseGenes())
+      (model.inGeneSet(g) ? gss.geneFalsePosPosterior : gss.geneFalseNegPosterior) [assocs.geneName[g]] = 1;
+    gss.hypergeometricPValue = assocs.hypergeometricPValues (geneSets[m], pValueThreshold);
+    summ.geneSetSummary.push_back (gss);
+  }
+  return summ;
+}
+
+void MCMC::startRunTimer() {
+  runPhaseStart = PhaseTimer::now();
+  runBurning = samplesIncludingBurn < burn;
+}
+
+void MCMC::updateRunTimer() {
+  if (timer && runBurning && samplesIncludingBurn >= burn) {
+    timer->add ("burn-in", runPhaseStart);
+    runPhaseStart = PhaseTimer::now();
+    runBurning = false;
+  }
+}
+
+void MCMC::stopRunTimer() {
+  if (timer)
+    timer->add (runBurning ? "burn-in" : "sampling", runPhaseStart);
+}
+
+size_t MCMC::modelBytes() const {
+  size_t b = vector_bytes(models);
+  for (auto& model : models)
+    b += model.bytes();
+  return b;
+}
+
+size_t MCMC::occupancyBytes() const {
+  size_t b = 0;
+  for (auto& model : models)
+    b += model.occupancyBytes();
+  return b;
+}
+
+void MCMC::initSamplers() {
+  moveSampler.init (moveRate);
+  modelSampler.init (modelWeight);
+}
+
+string MCMC::moveTypeName (MoveType type) {
+  switch (type) {
+  case Model::Flip: return "flip";
+  case Model::Step: return "step";
+  case Model::Jump: return "jump";
+  case Model::Randomize: return "randomize";
+  case Model::MultipleTry: return "multipleTry";
+  default: break;
+  }
+  throw runtime_error("Unknown move type");
+}
+
+void MCMC::step (size_t sample, size_t nSamples, RandomGenerator& generator) {
+  const bool adapting = adaptMoveRates && samplesIncludingBurn < burn;
+  Move move;
+  move.samples = sample;
+  move.totalSamples = nSamples;
+  move.type = (MoveType) moveSampler.sample (generator);
+  move.keepDelta = LoggingThisAt(2);
+  // only the proposal & accept/reject are timed for adaptation, not the logging & bookkeeping around them
+  const auto adaptStart = adapting ? PhaseTimer::Clock::now() : PhaseTimer::Clock::time_point();
+  move.propose (models, modelSampler, generator);
+  move.model->occupancyClock = samples;
+  if (move.type == Model::MultipleTry)
+    move.model->sampleMultipleTryMoveCollapsed (move, multipleTryType, multipleTries, countsWithPrior, generator, inverseTemperature);
+  else
+    move.model->sampleMoveCollapsed (move, countsWithPrior, generator, inverseTemperature);
+  const double moveSeconds = adapting ? std::chrono::duration<double> (PhaseTimer::Clock::now() - adaptStart).count() : 0;
+
+  LogThisAt(2,"Move #" << (samplesIncludingBurn+1) << ": " << move.toJSON() << endl);
+  ++movesProposed[move.type];
+  if (move.accepted)
+    ++movesAccepted[move.type];
+
+  if (adapting) {
+    if (adaptProposed.empty()) {
+      adaptProposed = adaptAccepted = vguard<uint64_t> (Model::TotalMoveTypes, 0);
+      adaptSeconds = vguard<double> (Model::TotalMoveTypes, 0.);
+    }
+    adaptSeconds[move.type] += moveSeconds;
+    ++adaptProposed[move.type];
+    if (move.accepted)
+      ++adaptAccepted[move.type];
+    // retune ten times during burn-in, the last time as it ends
+    const size_t done = samplesIncludingBurn + 1, interval = max (burn / 10, (size_t) 1);
+    if (done % interval == 0 || done == burn)
+      tuneMoveRates();
+    if (done == burn)
+      LogThisAt(1,"Move rates after burn-in: " << moveRateToJSON (moveRate) << endl);
+  }
+
+  ++samplesIncludingBurn;
+  if (finishedBurn() && recordSamples) {
+    ++samples;
+    if (raoBlackwellInterval && samples % raoBlackwellInterval == 0) {
+      for (auto& model : models)
+	model.recordTermConditionals (countsWithPrior);
+      ++conditionalSamples;
+    }
+  }
+}
+
+// the rates r of the tried types maximize the mixture's accepted moves per second, sum(r*accepted)/sum(r*seconds)
+// with accepted & seconds per proposal, subject to minAdaptedRate <= r <= 1.
+// this is linear-fractional, so at the optimum the types with the most accepted moves per second have rate 1
+// & the rest minAdaptedRate; each such split is tried. types not yet tried keep their rates
+void MCMC::tuneMoveRates() {
+  vguard<size_t> tried;
+  vguard<double> accepted (moveRate.size(), 0), seconds (moveRate.size(), 0), throughput (moveRate.size(), 0);
+  auto ratio = [] (double acc, double sec) {
+    return sec > 0 ? (acc / sec) : (acc > 0 ? numeric_limits<double>::infinity() : 0);
+  };
+  for (size_t t = 0; t < moveRate.size(); ++t)
+    if (moveRate[t] > 0 && adaptProposed[t] > 0) {
+      tried.push_back (t);
+      accepted[t] = adaptAccepted[t] / (double) adaptProposed[t];
+      seconds[t] = adaptSeconds[t] / adaptProposed[t];
+      throughput[t] = ratio (accepted[t], seconds[t]);
+    }
+  stable_sort (tried.begin(), tried.end(), [&] (size_t a, size_t b) { return throughput[a] > throughput[b]; });
+
+  double bestThroughput = 0;
+  size_t bestTop = 0;  // number of types at rate 1
+  for (size_t top = 1; top <= tried.size(); ++top) {
+    double acc = 0, sec = 0;
+    for (size_t i = 0; i < tried.size(); ++i) {
+      const double r = i < top ? 1 : minAdaptedRate;
+      acc += r * accepted[tried[i]];
+      sec += r * seconds[tried[i]];
+    }
+    const double mixThroughput = ratio (acc, sec);
+    if (mixThroughput > bestThroughput) {
+      bestThroughput = mixThroughput;
+      bestTop = top;
+    }
+  }
+  if (bestTop == 0)
+    return;
+  for (size_t i = 0; i < tried.size(); ++i)
+    moveRate[tried[i]] = i < bestTop ? 1 : minAdaptedRate;
+  moveSampler.init (moveRate);
+}
+
+string MCMC::moveRateToJSON (const MoveRate& rate) {
+  list<string> rateJson;
+  for (size_t t = 0; t < rate.size(); ++t)
+    rateJson.push_back (string("\"") + moveTypeName ((MoveType) t) + "\":" + to_string (rate[t]));
+  return string("{") + join(rateJson,",") + "}";
+}
+
+LogProb MCMC::currentLogLikelihood() const {
+  BernoulliCounts counts (countsWithPrior);
+  for (size_t n = 0; n < prior.nParams(); ++n) {
+    counts.succ[n] -= prior.succ[n];
+    counts.fail[n] -= prior.fail[n];
+  }
+  return counts.logBetaBernoulli (prior);
+}
+
+void MCMC::runUncollapsed (size_t nSweeps, RandomGenerator& generator) {
+  if (nVariables == 0) {
+    Warn ("Refusing to run MCMC on a model with no variables");
+    return;
+  }
+
+  ProgressLog (plog, 1);
+  // given the parameters & the hub terms, the connected components of all the models are conditionally independent,
+  // so they are the units of work. each model gets its own stream, which its hub terms use;
+  // each component gets its own too, unless it is all the model has, so results do not depend on the number of threads
+  vguard<pair<ModelIndex,size_t> > components;
+  vguard<RandomGenerator> componentGenerator, hubGenerator;
+  size_t nEnumerated = 0, nHubTerms = 0;
+  for (ModelIndex n = 0; n < models.size(); ++n) {
+    models[n].maxEnumeratedTerms = maxEnumeratedTerms;
+    for (auto& terms : models[n].componentTerms)
+      if (terms.size() <= maxEnumeratedTerms)
+	++nEnumerated;
+    nHubTerms += models[n].hubTerms.size();
+    hubGenerator.push_back (split_generator (generator));
+    RandomGenerator& modelGenerator = hubGenerator.back();
+    const size_t nComponents = models[n].componentTerms.size();
+    const bool shareStream = nComponents == 1 && models[n].hubTerms.empty();
+    for (size_t c = 0; c < nComponents; ++c) {
+      components.push_back (make_pair (n, c));
+      componentGenerator.push_back (shareStream ? modelGenerator : split_generator (modelGenerator));
+    }
+  }
+  plog.initProgress ("Uncollapsed MCMC run (%u models, %u hub terms, %u components of which %u enumerated, %u variables, %u threads)", models.size(), nHubTerms, components.size(), nEnumerated, nVariables, nThreads);
+
+  vguard<BernoulliCounts> componentDelta (components.size());
+  vguard<Model::StateSetChanges> componentChanges (nThreads > 1 ? components.size() : 0);
+  startRunTimer();
+  for (size_t sweep = 0; sweep < nSweeps; ++sweep) {
+
+    plog.logProgress (sweep / (double) (nSweeps - 1), "sweep %u/%u", sweep + 1, nSweeps);
+
+    const BernoulliParams p = countsWithPrior.sampleParams (generator);
+    const BernoulliLogParams logParams (p);
+    LogThisAt(2,"Sweep #" << (samplesIncludingBurn+1) << ": params (" << join(params.paramName,",") << ") = (" << to_string_join(p,",") << ")" << endl);
+
+    // the state after this sweep is recorded if burn-in is over by then
+    const bool record = samplesIncludingBurn + 1 > burn;
+    for (auto& model : models)
+      model.occupancyClock = samples;
+    for (ModelIndex n = 0; n < models.size(); ++n)
+      if (models[n].hubTerms.size())
+	countsWithPrior += models[n].gibbsSweepHubsUncollapsed (logParams, hubGenerator[n]);
+    auto sweepComponents = [&] (size_t first) {
+      for (size_t n = first; n < components.size(); n += nThreads)
+	componentDelta[n] = models[components[n].first].gibbsSweepUncollapsed (logParams, components[n].second, record, componentGenerator[n],
+										componentChanges.empty() ? NULL : &componentChanges[n]);
+    };
+    if (nThreads > 1) {
+      for (auto& model : models)
+	model.beginParallelSweep();
+      list<thread> threads;
+      for (size_t t = 0; t < nThreads; ++t)
+	threads.push_back (thread (sweepComponents, t));
+      for (auto& thr: threads)
+	thr.join();
+      for (size_t n = 0; n < components.size(); ++n) {
+	models[components[n].first].applyStateSetChanges (componentChanges[n]);
+	componentChanges[n] = Model::StateSetChanges();
       }
+      for (auto& model : models)
+	model.endParallelSweep();
+    } else
+      sweepComponents (0);
+
+    for (auto& d: componentDelta)
+      countsWithPrior += d;
+
+    ++samplesIncludingBurn;
+    if (finishedBurn())
+      ++samples;
+    updateRunTimer();
+  }
+  stopRunTimer();
+}
+
+MCMC::Summary MCMC::summary (double postProbThreshold, double pValueThreshold) const {
+  return pooledSummary (vguard<const MCMC*> (1, this), postProbThreshold, pValueThreshold);
+}
+
+MCMC::Summary MCMC::pooledSummary (const vguard<const MCMC*>& chains, double postProbThreshold, double pValueThreshold) {
+  return pooledPartial (chains, pValueThreshold).summary (postProbThreshold);
+}
+
+MCMC::Partial MCMC::partial (double pValueThreshold) const {
+  return pooledPartial (vguard<const MCMC*> (1, this), pValueThreshold);
+}
+
+MCMC::Partial MCMC::pooledPartial (const vguard<const MCMC*>& chains, double pValueThreshold) {
+  const MCMC& first = *chains.front();
+  const Assocs& assocs = first.assocs;
+  Partial part;
+  part.params = first.params;
+  part.prior = first.prior;
+  part.moveRate = first.moveRate;
+  part.adaptedMoveRates = first.adaptMoveRates;
+  part.movesProposed = part.movesAccepted = vguard<uint64_t> (Model::TotalMoveTypes, 0);
+  size_t samples = 0, conditionalSamples = 0;
+  for (auto chain : chains) {
+    samples += chain->samples;
+    conditionalSamples += chain->conditionalSamples;
+    for (size_t t = 0; t < Model::TotalMoveTypes; ++t) {
+      part.movesProposed[t] += chain->movesProposed[t];
+      part.movesAccepted[t] += chain->movesAccepted[t];
+    }
+  }
+  const auto equiv = assocs.termEquivalents();
+  for (ModelIndex m = 0; m < first.models.size(); ++m) {
+    auto& model = first.models[m];
+    GeneSetPartial gsp;
+    vguard<GeneName> names;
+    for (auto g : first.geneSets[m])
+      names.push_back (assocs.geneName[g]);
+    sort (names.begin(), names.end());
+    gsp.key = fnv1a_hash (join (names, "\t"));
+    gsp.samples = samples;
+    gsp.conditionalSamples = conditionalSamples;
+    for (Model::LocalTermIndex lt = 0; lt < (Model::LocalTermIndex) model.relevantTerms.size(); ++lt) {
+      double occ = 0;
+      for (auto chain : chains)
+	occ += chain->models[m].termOccupancyEstimate (lt, chain->samples);
+      auto& tn = assocs.ontology.termName[model.relevantTerms[lt]];
+      gsp.termOccupancy[tn] = occ;
+      if (conditionalSamples) {
+	double cond = 0;
+	for (auto chain : chains)
+	  cond += chain->models[m].termConditionalSum (lt);
+	gsp.termConditional[tn] = cond;
+      }
+      if (equiv.count(tn))
+	part.termEquivalents[tn] = equiv.at(tn);
     }
-    for (Assocs::GeneIndex g = 0; g < assocs.genes(); ++g) {
-      GeneProb& geneProb (model.inGeneSet[g] ? gss.geneFalsePosPosterior : gss.geneFalseNegPosterior);
-      const double p = geneFalseOccupancy[m][g] / (double) samples;
+    // only relevant genes can be false: the rest are always inactive & out of the set
+    for (Model::LocalGeneIndex lg = 0; lg < (Model::LocalGeneIndex) model.relevantGenes.size(); ++lg) {
+      double occ = 0;
+      for (auto chain : chains)
+	occ += chain->models[m].geneFalseOccupancyEstimate (lg, chain->samples);
+      (model.localGeneInSet(lg) ? gsp.geneFalsePosOccupancy : gsp.geneFalseNegOccupancy) [assocs.geneName[model.relevantGenes[lg]]] = occ;
+    }
+    gsp.hypergeometricPValue = assocs.hypergeometricPValues (first.geneSets[m], pValueThreshold);
+    part.geneSetPartial.push_back (gsp);
+  }
+  return part;
+}
+
+MCMC::Summary MCMC::Partial::summary (double postProbThreshold) const {
+  Summary summ;
+  summ.params = params;
+  summ.prior = prior;
+  summ.moveRate = moveRate;
+  auto posteriors = [&] (const map<string,double>& occupancy, uint64_t samples, map<string,double>& posterior) {
+    for (auto& occ : occupancy) {
+      const double p = occ.second / (double) samples;
       if (p >= postProbThreshold)
-	geneProb[assocs.geneName[g]] = p;
+	posterior[occ.first] = p;
     }
-    gss.hypergeometricPValue = assocs.hypergeometricPValues (geneSets[m], pValueThreshold);
+  };
+  for (auto& gsp : geneSetPartial) {
+    GeneSetSummary gss;
+    posteriors (gsp.termOccupancy, gsp.samples, gss.termPosterior);
+    if (gsp.conditionalSamples) {
+      gss.hasRaoBlackwell = true;
+      posteriors (gsp.termConditional, gsp.conditionalSamples, gss.termRaoBlackwell);
+    }
+    posteriors (gsp.geneFalsePosOccupancy, gsp.samples, gss.geneFalsePosPosterior);
+    posteriors (gsp.geneFalseNegOccupancy, gsp.samples, gss.geneFalseNegPosterior);
+    for (auto& tp : gss.termPosterior) {
+      auto iter = termEquivalents.find (tp.first);
+      if (iter != termEquivalents.end())
+	summ.termEquivalents.insert (*iter);
+    }
+    gss.hypergeometricPValue = gsp.hypergeometricPValue;
     summ.geneSetSummary.push_back (gss);
   }
+  list<string> extraJson;
+  if (inverseTemperature.size())
+    extraJson.push_back (replicaExchangeToJSON());
+  if (adaptedMoveRates)
+    extraJson.push_back (string("\"moveRate\":") + moveRateToJSON (moveRate));
+  summ.extraJSON = join (extraJson, ",");
+  return summ;
+}
+
+void MCMC::Partial::merge (const Partial& other) {
+  if (params.nParams() == 0) {
+    *this = other;
+    return;
+  }
+  if (other.contentHash != contentHash)
+    throw runtime_error ("Partial results are from different ontologies, associations or priors");
+  for (size_t t = 0; t < movesProposed.size(); ++t) {
+    movesProposed[t] += other.movesProposed[t];
+    movesAccepted[t] += other.movesAccepted[t];
+  }
+  termEquivalents.insert (other.termEquivalents.begin(), other.termEquivalents.end());
+  if (inverseTemperature == other.inverseTemperature)
+    for (size_t lo = 0; lo < swapAttempts.size(); ++lo) {
+      swapAttempts[lo] += other.swapAttempts[lo];
+      swapAccepts[lo] += other.swapAccepts[lo];
+    }
+  else {
+    Warn ("Partial results have different replica-exchange ladders; dropping swap statistics");
+    inverseTemperature.clear();
+    swapAttempts.clear();
+    swapAccepts.clear();
+  }
+  map<pair<uint64_t,string>,size_t> geneSetByKey;
+  for (size_t n = 0; n < geneSetPartial.size(); ++n)
+    geneSetByKey[make_pair (geneSetPartial[n].key, geneSetPartial[n].name)] = n;
+  auto addOccupancy = [] (map<string,double>& occupancy, const map<string,double>& otherOccupancy) {
+    for (auto& occ : otherOccupancy)
+      occupancy[occ.first] += occ.second;
+  };
+  for (auto& ogsp : other.geneSetPartial) {
+    const auto key = make_pair (ogsp.key, ogsp.name);
+    auto iter = geneSetByKey.find (key);
+    if (iter == geneSetByKey.end()) {
+      geneSetByKey[key] = geneSetPartial.size();
+      geneSetPartial.push_back (ogsp);
+    } else {
+      GeneSetPartial& gsp = geneSetPartial[iter->second];
+      gsp.samples += ogsp.samples;
+      gsp.conditionalSamples += ogsp.conditionalSamples;
+      addOccupancy (gsp.termConditional, ogsp.termConditional);
+      addOccupancy (gsp.termOccupancy, ogsp.termOccupancy);
+      addOccupancy (gsp.geneFalsePosOccupancy, ogsp.geneFalsePosOccupancy);
+      addOccupancy (gsp.geneFalseNegOccupancy, ogsp.geneFalseNegOccupancy);
+    }
+  }
+}
+
+string MCMC::Partial::replicaExchangeToJSON() const {
+  vguard<double> swapRate;
+  for (size_t lo = 0; lo < swapAttempts.size(); ++lo)
+    swapRate.push_back (swapAttempts[lo] ? (swapAccepts[lo] / (double) swapAttempts[lo]) : 0.);
+  return string("\"replicaExchange\":{\"inverseTemperature\":[") + to_string_join(inverseTemperature,",")
+    + "],\"swapAttempts\":[" + to_string_join(swapAttempts,",")
+    + "],\"swapRate\":[" + to_string_join(swapRate,",") + "]}";
+}
+
+uint64_t MCMC::Partial::hashContent (const Assocs& assocs, const BernoulliParamSet& params, const BernoulliCounts& prior) {
+  const Ontology& ontology = assocs.ontology;
+  auto strHash = fnv1a_hash;
+  uint64_t h = 0;
+  vguard<uint64_t> termHash (ontology.terms());
+  for (Ontology::TermIndex t = 0; t < ontology.terms(); ++t) {
+    termHash[t] = strHash (ontology.termName[t]);
+    h = derive_seed (h, termHash[t]);
+    for (auto p : ontology.parents[t])
+      h = derive_seed (h, strHash (ontology.termName[p]));
+  }
+  // gene-term pairs are combined by addition, so that the numbering of genes doesn't matter
+  uint64_t pairs = 0;
+  for (Assocs::GeneIndex g = 0; g < assocs.genes(); ++g) {
+    const uint64_t geneHash = strHash (assocs.geneName[g]);
+    for (auto t : assocs.termsByGene[g])
+      pairs += derive_seed (geneHash, termHash[t]);
+  }
+  h = derive_seed (h, pairs);
+  for (BernoulliParamIndex n = 0; n < params.nParams(); ++n)
+    h = derive_seed (h, strHash (params.paramName[n] + "\t" + to_string (prior.succ[n]) + "\t" + to_string (prior.fail[n])));
+  return h;
+}
+
+const char* partial_magic = "wtfgenes-partial-4";
+
+void MCMC::Partial::write (ostream& out) const {
+  auto writeMap = [&] (const map<string,double>& m) {
+    writeStrings (out, extract_keys (m));
+    writeArray<double> (out, extract_values (m));
+  };
+  writeMagic (out, partial_magic);
+  writeSize (out, contentHash);
+  writeStrings (out, params.paramName);
+  writeArray<double> (out, prior.succ);
+  writeArray<double> (out, prior.fail);
+  writeArray<double> (out, moveRate);
+  writeSize (out, adaptedMoveRates);
+  writeArray<uint64_t> (out, movesProposed);
+  writeArray<uint64_t> (out, movesAccepted);
+  writeSize (out, termEquivalents.size());
+  for (auto& te : termEquivalents) {
+    writeString (out, te.first);
+    writeStrings (out, te.second);
+  }
+  writeSize (out, geneSetPartial.size());
+  for (auto& gsp : geneSetPartial) {
+    writeSize (out, gsp.key);
+    writeString (out, gsp.name);
+    writeSize (out, gsp.samples);
+    writeMap (gsp.termOccupancy);
+    writeMap (gsp.geneFalsePosOccupancy);
+    writeMap (gsp.geneFalseNegOccupancy);
+    writeSize (out, gsp.conditionalSamples);
+    writeMap (gsp.termConditional);
+    writeStrings (out, extract_keys (gsp.hypergeometricPValue));
+    writeArray<double> (out, extract_values (gsp.hypergeometricPValue));
+  }
+  writeArray<double> (out, inverseTemperature);
+  writeArray<uint64_t> (out, swapAttempts);
+  writeArray<uint64_t> (out, swapAccepts);
+}
+
+void MCMC::Partial::read (istream& in) {
+  auto readMap = [&] (map<string,double>& m) {
+    const vguard<string> keys = readStrings (in);
+    const vguard<double> values = readArray<double> (in);
+    for (size_t n = 0; n < keys.size(); ++n)
+      m[keys[n]] = values[n];
+  };
+  readMagic (in, partial_magic, "wtfgenes partial result");
+  contentHash = readSize (in);
+  params = BernoulliParamSet();
+  for (auto& name : readStrings (in))
+    params.addParam (name);
+  prior.succ = readArray<double> (in);
+  prior.fail = readArray<double> (in);
+  moveRate = readArray<double> (in);
+  adaptedMoveRates = readSize (in);
+  movesProposed = readArray<uint64_t> (in);
+  movesAccepted = readArray<uint64_t> (in);
+  termEquivalents.clear();
+  for (size_t n = readSize (in); n > 0; --n) {
+    const TermName tn = readString (in);
+    const vguard<string> equivs = readStrings (in);
+    termEquivalents[tn] = list<TermName> (equivs.begin(), equivs.end());
+  }
+  geneSetPartial = vguard<GeneSetPartial> (readSize (in));
+  for (auto& gsp : geneSetPartial) {
+    gsp.key = readSize (in);
+    gsp.name = readString (in);
+    gsp.samples = readSize (in);
+    readMap (gsp.termOccupancy);
+    readMap (gsp.geneFalsePosOccupancy);
+    readMap (gsp.geneFalseNegOccupancy);
+    gsp.conditionalSamples = readSize (in);
+    readMap (gsp.termConditional);
+    const vguard<string> terms = readStrings (in);
+    const vguard<double> pValues = readArray<double> (in);
+    for (size_t n = 0; n < terms.size(); ++n)
+      gsp.hypergeometricPValue[terms[n]] = pValues[n];
+  }
+  inverseTemperature = readArray<double> (in);
+  swapAttempts = readArray<uint64_t> (in);
+  swapAccepts = readArray<uint64_t> (in);
+}
+
+MCMC::Summary MCMC::Summary::combine (const map<string,Summary>& parts, const string& partsKey) {
+  const Summary& first = parts.begin()->second;
+  Summary summ;
+  summ.params = first.params;
+  summ.prior = first.prior;
+  summ.moveRate = first.moveRate;
+  summ.geneSetSummary = vguard<GeneSetSummary> (first.geneSetSummary.size());
+  list<string> partJson;
+  for (auto& part : parts) {
+    const Summary& ps = part.second;
+    for (size_t n = 0; n < ps.geneSetSummary.size(); ++n) {
+      GeneSetSummary& gss = summ.geneSetSummary[n];
+      gss.hypergeometricPValue.insert (ps.geneSetSummary[n].hypergeometricPValue.begin(), ps.geneSetSummary[n].hypergeometricPValue.end());
+      gss.termPosterior.insert (ps.geneSetSummary[n].termPosterior.begin(), ps.geneSetSummary[n].termPosterior.end());
+      gss.hasRaoBlackwell = gss.hasRaoBlackwell || ps.geneSetSummary[n].hasRaoBlackwell;
+      gss.termRaoBlackwell.insert (ps.geneSetSummary[n].termRaoBlackwell.begin(), ps.geneSetSummary[n].termRaoBlackwell.end());
+    }
+    summ.termEquivalents.insert (ps.termEquivalents.begin(), ps.termEquivalents.end());
+    partJson.push_back (string("\"") + part.first + "\":" + ps.toJSON());
+  }
+  summ.extraJSON = string("\"") + partsKey + "\":{" + join(partJson,",") + "}";
   return summ;
 }
 
@@ -112,7 +732,8 @@ string MCMC::GeneSetSummary::probsToJson (const map<string,double>& p) {
 }
 
 string MCMC::GeneSetSummary::toJSON() const {
-  return string("{\"hypergeometricPValue\":{\"term\":") + probsToJson(hypergeometricPValue) + "},\"posteriorMarginal\":{\"term\":" + probsToJson(termPosterior) + ",\"gene\":{\"falsePos\":" + probsToJson(geneFalsePosPosterior) + ",\"falseNeg\":" + probsToJson(geneFalseNegPosterior) + "}}}";
+  return string("{\"hypergeometricPValue\":{\"term\":") + probsToJson(hypergeometricPValue) + "},\"posteriorMarginal\":{\"term\":" + probsToJson(termPosterior) + ",\"gene\":{\"falsePos\":" + probsToJson(geneFalsePosPosterior) + ",\"falseNeg\":" + probsToJson(geneFalseNegPosterior) + "}}"
+    + (hasRaoBlackwell ? (string(",\"raoBlackwellMarginal\":{\"term\":") + probsToJson(termRaoBlackwell) + "}") : string()) + "}";
 }
 
 string MCMC::Summary::toJSON() const {
@@ -126,5 +747,6 @@ string MCMC::Summary::toJSON() const {
       s.push_back (string("\"") + e + "\"");
     eqJson.push_back (string("\"") + te.first + "\":[" + join(s,",") + "]");
   }
-  return string("{\"termEquivalents\":{" + join(eqJson,",") + "},\"summary\":[") + join(summJson,",") + "]}";
+  return string("{\"termEquivalents\":{" + join(eqJson,",") + "},\"summary\":[") + join(summJson,",") + "]"
+    + (extraJSON.empty() ? string() : (string(",") + extraJSON)) + "}";
 }
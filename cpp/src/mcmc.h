@@ -2,8 +2,10 @@
 #define MCMC_INCLUDED
 
 #include "model.h"
+#include "logger.h"
 
 struct MCMC {
+  typedef Ontology::TermIndex TermIndex;
   typedef Ontology::TermName TermName;
   typedef Assocs::GeneName GeneName;
 
@@ -18,9 +20,15 @@ struct MCMC {
 
   typedef size_t ModelIndex;
 
+  // maximum a posteriori search: simulated annealing, or greedy hill-climbing (accepting only improvements)
+  enum MapMethod { Anneal, Greedy };
+
   struct GeneSetSummary {
     TermProb hypergeometricPValue, termPosterior;
     GeneProb geneFalsePosPosterior, geneFalseNegPosterior;
+    bool hasRaoBlackwell;  // if true, termRaoBlackwell holds the averaged conditional probabilities
+    TermProb termRaoBlackwell;
+    GeneSetSummary() : hasRaoBlackwell(false) { }
     string toJSON() const;
     static string probsToJson (const map<string,double>& p);
   };
@@ -31,7 +39,52 @@ struct MCMC {
     MoveRate moveRate;
     vguard<GeneSetSummary> geneSetSummary;
     map<TermName,list<TermName> > termEquivalents;
+    string extraJSON;  // e.g. replica-exchange statistics; appended to the top-level object if nonempty
     string toJSON() const;
+    // merges the term results of analyses over disjoint terms (e.g. ontology namespaces);
+    // gene results are not comparable across analyses, so each part's full summary goes in extraJSON under partsKey
+    static Summary combine (const map<string,Summary>& parts, const string& partsKey);
+  };
+
+  // raw occupancy counts which, unlike a Summary's probabilities, can be summed exactly,
+  // so that chains or gene sets sharded across processes can be merged
+  struct GeneSetPartial {
+    uint64_t key;  // hash of the gene names; shards' results for the same named gene set are pooled
+    string name;  // the set's name in a GMT file, or empty
+    uint64_t samples;
+    map<TermName,double> termOccupancy;  // every relevant term; not always integral (see Model::termOccupancyEstimate)
+    map<GeneName,double> geneFalsePosOccupancy, geneFalseNegOccupancy;  // every relevant gene
+    TermProb hypergeometricPValue;
+    uint64_t conditionalSamples;  // samples at which the terms' conditional probabilities were added
+    map<TermName,double> termConditional;  // every relevant term, if conditionalSamples > 0
+    GeneSetPartial() : conditionalSamples(0) { }
+  };
+
+  struct Partial {
+    uint64_t contentHash;  // of ontology, associations, parameters & prior; set by the caller (see hashContent())
+    BernoulliParamSet params;
+    BernoulliCounts prior;
+    MoveRate moveRate;
+    bool adaptedMoveRates;  // moveRate was tuned during burn-in, so is reported; merged partials keep the first one's
+    vguard<uint64_t> movesProposed, movesAccepted;  // indexed by MoveType
+    map<TermName,list<TermName> > termEquivalents;  // for every relevant term that has equivalents
+    vguard<GeneSetPartial> geneSetPartial;
+    // replica-exchange swap statistics, indexed by the lower rung of each adjacent pair; empty for a single chain
+    vguard<double> inverseTemperature;  // indexed by rung
+    vguard<uint64_t> swapAttempts, swapAccepts;
+
+    Partial() : contentHash(0), adaptedMoveRates(false) { }
+    static uint64_t hashContent (const Assocs& assocs, const BernoulliParamSet& params, const BernoulliCounts& prior);
+
+    // sums the counts for gene sets in both partials, & appends the other's remaining gene sets.
+    // Merging into a default-constructed Partial copies the other
+    void merge (const Partial& other);
+    // the summary's extraJSON has the swap statistics & adapted move rates, as for a single run
+    Summary summary (double postProbThreshold = .01) const;
+    string replicaExchangeToJSON() const;
+
+    void write (ostream& out) const;
+    void read (istream& in);
   };
 
   const Assocs& assocs;
@@ -48,10 +101,28 @@ struct MCMC {
 
   MoveRate moveRate;
   vguard<double> modelWeight;
+  alias_sampler moveSampler, modelSampler;  // rebuilt from moveRate & modelWeight at the start of each run
 
-  size_t samples, samplesIncludingBurn, burn;
-  vguard<vguard<int> > termStateOccupancy;  // indexed by model index & TermIndex
-  vguard<vguard<int> > geneFalseOccupancy;  // indexed by model index & GeneIndex
+  // if set, moveRate is tuned during burn-in for the most accepted moves per second, then frozen.
+  // each move type with a nonzero initial rate keeps at least minAdaptedRate, so it is still measured
+  bool adaptMoveRates;
+  double minAdaptedRate;
+
+  MoveType multipleTryType;  // candidate type for MultipleTry moves
+  size_t multipleTries;  // number of candidates per MultipleTry move
+
+  size_t nThreads;  // used by uncollapsed sampler & initModels
+  size_t maxEnumeratedTerms;  // see Model::maxEnumeratedTerms; used by uncollapsed sampler
+
+  double inverseTemperature;  // applied to log-likelihood ratios of collapsed moves
+  bool recordSamples;  // if false, samples after burn-in do not count towards occupancies (e.g. hot replicas)
+
+  size_t samples, samplesIncludingBurn, burn;  // term & gene occupancies are kept by each Model
+  size_t raoBlackwellInterval;  // if nonzero, Model::recordTermConditionals is called every this many recorded samples
+  size_t conditionalSamples;  // number of such calls
+  vguard<uint64_t> movesProposed, movesAccepted;  // indexed by MoveType
+
+  PhaseTimer* timer;  // if set, burn-in & sampling are timed as separate phases
 
   MCMC (const Assocs& assocs, const BernoulliParamSet& params, const BernoulliCounts& prior)
     : assocs(assocs),
@@ -60,9 +131,22 @@ struct MCMC {
       parameterization(assocs),
       nVariables(0),
       moveRate(Model::TotalMoveTypes),
+      adaptMoveRates(false),
+      minAdaptedRate(.05),
+      multipleTryType(Model::Flip),
+      multipleTries(4),
+      nThreads(1),
+      maxEnumeratedTerms(0),
+      inverseTemperature(1),
+      recordSamples(true),
       samples(0),
       samplesIncludingBurn(0),
-      burn(0)
+      burn(0),
+      raoBlackwellInterval(0),
+      conditionalSamples(0),
+      movesProposed(Model::TotalMoveTypes,0),
+      movesAccepted(Model::TotalMoveTypes,0),
+      timer(NULL)
   {
     moveRate[Model::Flip] = moveRate[Model::Step] = 1;
   }
@@ -71,12 +155,54 @@ struct MCMC {
 
   void initModels (const vguard<Assocs::GeneNameSet>& geneSets);
 
+  // warm starts: set a model's initial term states, or edit its gene set in place (see Model::updateGeneSet).
+  // editing restarts the burn-in & sample counts of every model, but not their term states
+  void setInitialTerms (ModelIndex m, const vguard<TermName>& termNames);
+  void updateGeneSet (ModelIndex m, const Assocs::GeneNameSet& geneNames);
+  void resetSamples();
+
   BernoulliCounts computeCounts() const;
   BernoulliCounts computeCountsWithPrior() const;
   LogProb collapsedLogLikelihood() const;
 
   void run (size_t nSamples, RandomGenerator& generator);
+  void initSamplers();  // must be called before step()
+  static string moveTypeName (MoveType type);
+  static string moveRateToJSON (const MoveRate& rate);
+  void step (size_t sample, size_t nSamples, RandomGenerator& generator);
+  LogProb currentLogLikelihood() const;  // collapsedLogLikelihood() from countsWithPrior, without a pass over the models
+  void runUncollapsed (size_t nSweeps, RandomGenerator& generator);
+
+  // searches for the term states maximizing collapsedLogLikelihood(), leaving the models in the best state found.
+  // each restart takes nSteps moves; the first starts from the current state, the rest from random sparse states.
+  // annealing raises the inverse temperature geometrically from annealFrom to annealTo over each restart.
+  // returns the best log-likelihood
+  LogProb searchMAP (MapMethod method, size_t nSteps, size_t nRestarts, RandomGenerator& generator, double annealFrom = 1, double annealTo = 100);
+  // the current term states as a Summary with probabilities of 1 (only hypergeometric p-values are thresholded)
+  Summary stateSummary (double pValueThreshold = .05) const;
+
+  // phase timing for a run: call updateRunTimer after each step or sweep
+  void startRunTimer();
+  void updateRunTimer();
+  void stopRunTimer();
+
+  size_t modelBytes() const;
+  size_t occupancyBytes() const;
+
   Summary summary (double postProbThreshold = .01, double pValueThreshold = .05) const;
+  // pools the occupancies of chains over the same gene sets, e.g. the replicas of a tempered run
+  static Summary pooledSummary (const vguard<const MCMC*>& chains, double postProbThreshold = .01, double pValueThreshold = .05);
+  Partial partial (double pValueThreshold = .05) const;
+  static Partial pooledPartial (const vguard<const MCMC*>& chains, double pValueThreshold = .05);
+
+private:
+  PhaseTimer::Stamp runPhaseStart;
+  bool runBurning;
+
+  // burn-in statistics for adaptMoveRates, indexed by MoveType
+  vguard<uint64_t> adaptProposed, adaptAccepted;
+  vguard<double> adaptSeconds;
+  void tuneMoveRates();
 };
 
 #endif /* MCMC_INCLUDED */
@@ -1,3 +1,4 @@
+#include <numeric>
 #include "model.h"
 
 Parameterization::Parameterization (const Assocs& assocs)
@@ -10,75 +11,288 @@ Parameterization::Parameterization (const Assocs& assocs)
   params.addParam ("fn");
 }
 
+bool Parameterization::hasUniformGeneParams() const {
+  for (size_t g = 1; g < geneFalsePos.size(); ++g)
+    if (geneFalsePos[g] != geneFalsePos[0] || geneFalseNeg[g] != geneFalseNeg[0])
+      return false;
+  return true;
+}
+
+bool Parameterization::isStandard() const {
+  if (params.paramName != vguard<BernoulliParamName> ({ "t", "fp", "fn" }))
+    return false;
+  for (auto p : termPrior)
+    if (p != StandardParamIndex::TermPrior)
+      return false;
+  for (auto p : geneFalsePos)
+    if (p != StandardParamIndex::FalsePos)
+      return false;
+  for (auto p : geneFalseNeg)
+    if (p != StandardParamIndex::FalseNeg)
+      return false;
+  return true;
+}
+
 Model::Model (const Assocs& assocs, const Parameterization& param)
   : assocs (assocs),
     parameterization (param),
     termName (assocs.ontology.termName),
     geneName (assocs.geneName),
-    inGeneSet (assocs.genes(), false),
-    isRelevant (assocs.terms(), false),
-    relevantNeighbors (assocs.terms()),
-    termState (assocs.terms(), false),
-    nActiveTermsByGene (assocs.genes(), 0)
+    maxEnumeratedTerms (0),
+    deferHubTermGeneCounts (false),
+    irrelevantGeneCounts (param.nParams()),
+    uniformGeneParams (param.hasUniformGeneParams()),
+    standardParams (param.isStandard()),
+    occupancyClock (0)
 { }
 
-void Model::init (const GeneNameSet& geneNames) {
+Model::GeneIndexSet Model::geneNamesToIndices (const GeneNameSet& geneNames) const {
+  GeneIndexSet gs;
   set<GeneName> missing;
   for (auto& n : geneNames)
     if (assocs.geneIndex.count(n))
-      geneSet.insert (assocs.geneIndex.at(n));
+      gs.insert (assocs.geneIndex.at(n));
     else
       missing.insert (n);
   if (missing.size())
     Warn ("Genes not found in the associations list: %s", join(missing).c_str());
+  return gs;
+}
+
+void Model::init (const GeneNameSet& geneNames) {
+  // start with every gene irrelevant, then bring in the gene set
+  const GenericParamIndex index (parameterization);
+  for (GeneIndex g = 0; g < genes(); ++g)
+    countObs (index, irrelevantGeneCounts, +1, false, false, g);
+  setGeneSet (geneNamesToIndices (geneNames));
+}
+
+void Model::updateGeneSet (const GeneNameSet& geneNames) {
+  // switch everything off, rebuild the relevant subgraph, then restore the terms that are still relevant
+  const vguard<TermIndex> prevActive (_activeTerms.begin(), _activeTerms.end());
+  for (auto t : prevActive)
+    setTermState (t, false);
+  setGeneSet (geneNamesToIndices (geneNames));
+  for (auto t : prevActive)
+    if (isRelevant (t))
+      setTermState (t, true);
+}
+
+void Model::setGeneSet (const GeneIndexSet& newGeneSet) {
+  Assert (_activeTerms.empty(), "Attempt to change the gene set of a model with active terms");
+  geneSet = newGeneSet;
 
   set<TermIndex> relevant;
-  for (auto g : geneSet) {
-    inGeneSet[g] = true;
-    _falseGenes.insert (g);
+  for (auto g : geneSet)
     for (auto t : assocs.termsByGene[g])
       if (assocs.termIsExemplar(t))
 	relevant.insert (t);
-  }
-
   relevantTerms = vguard<TermIndex> (relevant.begin(), relevant.end());
+
+  vguard<GeneIndex> newRelevantGenes (geneSet.begin(), geneSet.end());
   for (auto t : relevantTerms)
-    isRelevant[t] = true;
+    newRelevantGenes.insert (newRelevantGenes.end(), assocs.genesByTerm[t].begin(), assocs.genesByTerm[t].end());
+  sort (newRelevantGenes.begin(), newRelevantGenes.end());
+  newRelevantGenes.erase (unique (newRelevantGenes.begin(), newRelevantGenes.end()), newRelevantGenes.end());
+
+  // all terms are off, so genes entering or leaving the relevant set only move between these counts & getCounts()
+  vector<GeneIndex> entering, leaving;
+  set_difference (newRelevantGenes.begin(), newRelevantGenes.end(), relevantGenes.begin(), relevantGenes.end(), back_inserter(entering));
+  set_difference (relevantGenes.begin(), relevantGenes.end(), newRelevantGenes.begin(), newRelevantGenes.end(), back_inserter(leaving));
+  const GenericParamIndex index (parameterization);
+  for (auto g : entering)
+    countObs (index, irrelevantGeneCounts, -1, false, false, g);
+  for (auto g : leaving)
+    countObs (index, irrelevantGeneCounts, +1, false, false, g);
+
+  relevantGenes.swap (newRelevantGenes);
+  relevantGeneInSet = vguard<bool> (relevantGenes.size(), false);
+  auto geneIter = relevantGenes.begin();
+  for (auto g : geneSet) {
+    geneIter = lower_bound (geneIter, relevantGenes.end(), g);
+    relevantGeneInSet[geneIter - relevantGenes.begin()] = true;
+  }
+  nActiveTermsByGene = vguard<int> (relevantGenes.size(), 0);
+  _falseGenes = geneSet;
+
+  termState = vguard<char> (relevantTerms.size(), false);
+  termGeneCounts = vguard<TermGeneCounts> (relevantTerms.size());
+  hubTerms.clear();
+  for (LocalTermIndex lt = 0; lt < (LocalTermIndex) relevantTerms.size(); ++lt)
+    for (auto t : assocs.termsInEquivClass[assocs.equivClassByTerm[relevantTerms[lt]]])
+      if (assocs.ontology.parents[t].empty()) {
+	hubTerms.push_back (lt);
+	break;
+      }
+  // components are found by union-find, linking each non-hub term to the first term seen with each of its genes
+  auto hubIter = hubTerms.begin();
+  vguard<LocalTermIndex> componentRoot (relevantTerms.size()), geneFirstTerm (relevantGenes.size(), -1);
+  iota (componentRoot.begin(), componentRoot.end(), 0);
+  auto findRoot = [&] (LocalTermIndex lt) {
+    while (componentRoot[lt] != lt)
+      lt = componentRoot[lt] = componentRoot[componentRoot[lt]];
+    return lt;
+  };
+  for (LocalTermIndex lt = 0; lt < (LocalTermIndex) relevantTerms.size(); ++lt) {
+    TermGeneCounts& tgc = termGeneCounts[lt];
+    const bool isHub = hubIter != hubTerms.end() && *hubIter == lt;
+    if (isHub)
+      ++hubIter;
+    auto geneIter = relevantGenes.begin();
+    for (auto g : assocs.genesByTerm[relevantTerms[lt]]) {
+      geneIter = lower_bound (geneIter, relevantGenes.end(), g);
+      const LocalGeneIndex lg = geneIter - relevantGenes.begin();
+      if (relevantGeneInSet[lg])
+	++tgc.uncoveredInSet;
+      else
+	++tgc.uncoveredOutOfSet;
+      if (isHub)
+	continue;
+      if (geneFirstTerm[lg] < 0)
+	geneFirstTerm[lg] = lt;
+      else
+	componentRoot[findRoot(lt)] = findRoot (geneFirstTerm[lg]);
+    }
+  }
+  componentTerms.clear();
+  termComponent = vguard<int> (relevantTerms.size(), -1);
+  map<LocalTermIndex,size_t> rootComponent;
+  hubIter = hubTerms.begin();
+  for (LocalTermIndex lt = 0; lt < (LocalTermIndex) relevantTerms.size(); ++lt) {
+    if (hubIter != hubTerms.end() && *hubIter == lt) {
+      ++hubIter;
+      continue;
+    }
+    const LocalTermIndex root = findRoot (lt);
+    if (!rootComponent.count(root)) {
+      rootComponent[root] = componentTerms.size();
+      componentTerms.push_back (vguard<LocalTermIndex>());
+    }
+    termComponent[lt] = rootComponent[root];
+    componentTerms[termComponent[lt]].push_back (lt);
+  }
+  componentGenes = vguard<vguard<LocalGeneIndex> > (componentTerms.size());
+  geneComponent = vguard<int> (relevantGenes.size(), -1);
+  for (LocalGeneIndex lg = 0; lg < (LocalGeneIndex) relevantGenes.size(); ++lg)
+    if (geneFirstTerm[lg] >= 0) {
+      geneComponent[lg] = termComponent[geneFirstTerm[lg]];
+      componentGenes[geneComponent[lg]].push_back (lg);
+    }
 
+  relevantNeighbors.clear();
   for (auto t : relevantTerms) {
     set<TermIndex> nbr;
     for (auto p : assocs.ontology.parents[t]) {
-      if (isRelevant[p] && p != t)
+      if (p != t && isRelevant(p))
 	nbr.insert (p);
       for (auto s : assocs.ontology.children[p])
-	if (isRelevant[s] && s != t)
+	if (s != t && isRelevant(s))
 	  nbr.insert (s);
     }
     for (auto c : assocs.ontology.children[t])
-      if (isRelevant[c] && c != t)
+      if (c != t && isRelevant(c))
 	nbr.insert (c);
-    relevantNeighbors[t] = vguard<TermIndex> (nbr.begin(), nbr.end());
+    relevantNeighbors.push_back (vguard<TermIndex> (nbr.begin(), nbr.end()));
   }
+
+  termOccupancyTotal = termActiveSince = vguard<uint64_t> (relevantTerms.size(), 0);
+  geneFalseOccupancyTotal = vguard<uint64_t> (relevantGenes.size(), 0);
+  geneFalseSince = vguard<uint64_t> (relevantGenes.size(), occupancyClock);
+  termExpectedOccupancy = vguard<double> (relevantTerms.size(), 0);
+  geneFalseExpectedOccupancy = vguard<double> (relevantGenes.size(), 0);
+  termConditionalTotal = vguard<double> (relevantTerms.size(), 0);
+}
+
+void Model::resetOccupancy() {
+  occupancyClock = 0;
+  termOccupancyTotal = termActiveSince = vguard<uint64_t> (relevantTerms.size(), 0);
+  geneFalseOccupancyTotal = geneFalseSince = vguard<uint64_t> (relevantGenes.size(), 0);
+  termExpectedOccupancy = vguard<double> (relevantTerms.size(), 0);
+  geneFalseExpectedOccupancy = vguard<double> (relevantGenes.size(), 0);
+  termConditionalTotal = vguard<double> (relevantTerms.size(), 0);
+}
+
+size_t Model::bytes() const {
+  size_t b = set_bytes(geneSet) + vector_bytes(relevantTerms) + vector_bytes(relevantGenes) + vector_bytes(relevantNeighbors)
+    + vector_bytes(termState) + vector_bytes(termGeneCounts) + vector_bytes(relevantGeneInSet) + vector_bytes(nActiveTermsByGene)
+    + set_bytes(_activeTerms) + set_bytes(_falseGenes);
+  for (auto& nbrs : relevantNeighbors)
+    b += vector_bytes(nbrs);
+  b += vector_bytes(hubTerms) + vector_bytes(componentTerms) + vector_bytes(componentGenes) + vector_bytes(termComponent) + vector_bytes(geneComponent);
+  for (auto& comp : componentTerms)
+    b += vector_bytes(comp);
+  for (auto& comp : componentGenes)
+    b += vector_bytes(comp);
+  return b;
+}
+
+size_t Model::occupancyBytes() const {
+  return vector_bytes(termOccupancyTotal) + vector_bytes(termActiveSince) + vector_bytes(geneFalseOccupancyTotal) + vector_bytes(geneFalseSince)
+    + vector_bytes(termExpectedOccupancy) + vector_bytes(geneFalseExpectedOccupancy) + vector_bytes(termConditionalTotal);
 }
 
 void Model::setTermState (TermIndex t, bool val) {
-  Assert (isRelevant[t], "Attempt to set non-relevant term %s", assocs.ontology.termName[t].c_str());
-  if (termState[t] != val) {
+  ModelStateSets sets (*this);
+  setTermState (t, val, sets);
+}
+
+template<class StateSets>
+void Model::setTermState (TermIndex t, bool val, StateSets& sets) {
+  const LocalTermIndex lt = localTermIndex (t);
+  Assert (lt >= 0, "Attempt to set non-relevant term %s", assocs.ontology.termName[t].c_str());
+  if (termState[lt] != val) {
     const int delta = val ? +1 : -1;
+    // genesByTerm & relevantGenes are both sorted, so each lookup resumes where the last one stopped
+    auto geneIter = relevantGenes.begin();
     for (auto g : assocs.genesByTerm[t]) {
-      const int newCount = (nActiveTermsByGene[g] += delta);
-      const bool gInSet = inGeneSet[g],
+      geneIter = lower_bound (geneIter, relevantGenes.end(), g);
+      const LocalGeneIndex lg = geneIter - relevantGenes.begin();
+      const int newCount = (nActiveTermsByGene[lg] += delta);
+      const bool gInSet = relevantGeneInSet[lg],
 	gFalse = (newCount > 0 ? !gInSet : gInSet);
-      if (gFalse)
-	_falseGenes.insert (g);
-      else
-	_falseGenes.erase (g);
+      if (newCount <= 2 && newCount - delta <= 2)
+	updateTermGeneCounts (g, gInSet, newCount - delta, newCount);
+      if ((newCount > 0) != (newCount - delta > 0)) {
+	sets.setFalse (g, gFalse);
+	if (gFalse)
+	  geneFalseSince[lg] = occupancyClock;
+	else {
+	  geneFalseOccupancyTotal[lg] += occupancyClock - geneFalseSince[lg];
+	}
+      }
     }
+    sets.setActive (t, val);
     if (val)
-      _activeTerms.insert (t);
-    else
-      _activeTerms.erase (t);
-    termState[t] = val;
+      termActiveSince[lt] = occupancyClock;
+    else {
+      termOccupancyTotal[lt] += occupancyClock - termActiveSince[lt];
+    }
+    termState[lt] = val;
+  }
+}
+
+void Model::updateTermGeneCounts (GeneIndex g, bool gInSet, int oldCount, int newCount) {
+  auto termIter = relevantTerms.begin();
+  for (auto t : assocs.termsByGene[g]) {
+    termIter = lower_bound (termIter, relevantTerms.end(), t);
+    if (termIter == relevantTerms.end())
+      break;
+    if (*termIter != t)
+      continue;
+    const LocalTermIndex lt = termIter - relevantTerms.begin();
+    if (deferHubTermGeneCounts && termComponent[lt] < 0)
+      continue;
+    TermGeneCounts& tgc = termGeneCounts[lt];
+    int& uncovered = gInSet ? tgc.uncoveredInSet : tgc.uncoveredOutOfSet;
+    int& sole = gInSet ? tgc.soleInSet : tgc.soleOutOfSet;
+    if (oldCount == 0)
+      --uncovered;
+    else if (oldCount == 1)
+      --sole;
+    if (newCount == 0)
+      ++uncovered;
+    else if (newCount == 1)
+      ++sole;
   }
 }
 
@@ -89,39 +303,66 @@ void Model::setTermStates (const TermStateAssignment& tsa) {
 
 Model::TermStateAssignment Model::invert (const TermStateAssignment& tsa) const {
   Model::TermStateAssignment inv;
-  for (auto& ts : tsa)
-    if (ts.second != termState[ts.first])
-      inv[ts.first] = termState[ts.first];
+  for (auto& ts : tsa) {
+    const bool state = getTermState (ts.first);
+    if (ts.second != state)
+      inv[ts.first] = state;
+  }
   return inv;
 }
 
 BernoulliCounts Model::getCounts() const {
-  BernoulliCounts counts (parameterization.nParams());
-  for (auto t : relevantTerms)
-    countTerm (counts, +1, t, termState[t]);
-  for (GeneIndex g = 0; g < genes(); ++g)
-    countObs (counts, +1, nActiveTermsByGene[g] > 0, g);
+  const GenericParamIndex index (parameterization);
+  BernoulliCounts counts (irrelevantGeneCounts);
+  for (LocalTermIndex lt = 0; lt < (LocalTermIndex) relevantTerms.size(); ++lt)
+    countTerm (index, counts, +1, relevantTerms[lt], termState[lt]);
+  for (LocalGeneIndex lg = 0; lg < (LocalGeneIndex) relevantGenes.size(); ++lg)
+    countObs (index, counts, +1, nActiveTermsByGene[lg] > 0, relevantGeneInSet[lg], relevantGenes[lg]);
   return counts;
 }
 
-BernoulliCounts Model::getCountDelta (const TermStateAssignment& tsa) const {
-  map<GeneIndex,int> newActiveTermsByGene;
-  BernoulliCounts cd (parameterization.nParams());
+template<class ParamIndex>
+void Model::addFlipCountDelta (const ParamIndex& index, typename ParamIndex::Counts& cd, LocalTermIndex lt, bool val) const {
+  if (termState[lt] != val) {
+    const TermIndex t = relevantTerms[lt];
+    countTerm (index, cd, -1, t, termState[lt]);
+    countTerm (index, cd, +1, t, val);
+    // switching on activates the uncovered genes; switching off deactivates the genes covered only by this term
+    const TermGeneCounts& tgc = termGeneCounts[lt];
+    const int nInSet = val ? tgc.uncoveredInSet : tgc.soleInSet,
+      nOutOfSet = val ? tgc.uncoveredOutOfSet : tgc.soleOutOfSet;
+    countUniformObs (index, cd, -nInSet, !val, true);
+    countUniformObs (index, cd, +nInSet, val, true);
+    countUniformObs (index, cd, -nOutOfSet, !val, false);
+    countUniformObs (index, cd, +nOutOfSet, val, false);
+  }
+}
+
+template<class ParamIndex>
+void Model::addCountDelta (const ParamIndex& index, typename ParamIndex::Counts& cd, const TermStateAssignment& tsa) const {
+  if (tsa.size() == 1 && uniformGeneParams) {
+    addFlipCountDelta (index, cd, localTermIndex (tsa.begin()->first), tsa.begin()->second);
+    return;
+  }
+  map<LocalGeneIndex,int> newActiveTermsByGene;
   for (auto& ts : tsa) {
     const TermIndex t = ts.first;
     const bool val = ts.second;
-    //    Assert (isRelevant[t], "Attempt to set non-relevant term %s", assocs.ontology.termName[t].c_str());
-    if (termState[t] != val) {
-      countTerm (cd, -1, t, termState[t]);
-      countTerm (cd, +1, t, val);
+    const LocalTermIndex lt = localTermIndex (t);
+    if (termState[lt] != val) {
+      countTerm (index, cd, -1, t, termState[lt]);
+      countTerm (index, cd, +1, t, val);
       const int delta = val ? +1 : -1;
+      auto geneIter = relevantGenes.begin();
       for (auto g : assocs.genesByTerm[t]) {
+	geneIter = lower_bound (geneIter, relevantGenes.end(), g);
+	const LocalGeneIndex lg = geneIter - relevantGenes.begin();
 	int oldCount, newCount;
-	auto countIter = newActiveTermsByGene.find(g);
+	auto countIter = newActiveTermsByGene.find(lg);
 	if (countIter == newActiveTermsByGene.end()) {
-	  oldCount = nActiveTermsByGene[g];
+	  oldCount = nActiveTermsByGene[lg];
 	  newCount = oldCount + delta;
-	  newActiveTermsByGene[g] = newCount;
+	  newActiveTermsByGene[lg] = newCount;
 	} else {
 	  oldCount = countIter->second;
 	  newCount = oldCount + delta;
@@ -129,31 +370,57 @@ BernoulliCounts Model::getCountDelta (const TermStateAssignment& tsa) const {
 	}
 	const bool oldActive = oldCount > 0, newActive = newCount > 0;
 	if (oldActive != newActive) {
-	  countObs (cd, -1, oldActive, g);
-	  countObs (cd, +1, newActive, g);
+	  countObs (index, cd, -1, oldActive, relevantGeneInSet[lg], g);
+	  countObs (index, cd, +1, newActive, relevantGeneInSet[lg], g);
 	}
       }
     }
   }
+}
+
+template<class ParamIndex>
+void Model::addToggleCountDelta (const ParamIndex& index, typename ParamIndex::Counts& cd, LocalTermIndex lt) const {
+  if (uniformGeneParams)
+    addFlipCountDelta (index, cd, lt, !termState[lt]);
+  else {
+    TermStateAssignment tsa;
+    tsa[relevantTerms[lt]] = !termState[lt];
+    addCountDelta (index, cd, tsa);
+  }
+}
+
+BernoulliCounts Model::getCountDelta (const TermStateAssignment& tsa) const {
+  if (standardParams) {
+    StandardParamIndex::Counts cd;
+    addCountDelta (StandardParamIndex(), cd, tsa);
+    return cd;
+  }
+  const GenericParamIndex index (parameterization);
+  BernoulliCounts cd = index.newCounts();
+  addCountDelta (index, cd, tsa);
   return cd;
 }
 
 void Model::proposeFlipMove (Move& move, RandomGenerator& generator) const {
-  TermIndex term = random_element (relevantTerms, generator);
-  move.termStates[term] = !termState[term];
+  const LocalTermIndex lt = (LocalTermIndex) (random_double(generator) * relevantTerms.size());
+  move.termStates[relevantTerms[lt]] = !termState[lt];
+  move.logProposalProb = -log (relevantTerms.size());
 }
 
 void Model::proposeStepMove (Move& move, RandomGenerator& generator) const {
   if (!_activeTerms.empty()) {
     const vguard<TermIndex> actives (_activeTerms.begin(), _activeTerms.end());
     const TermIndex term = random_element (actives, generator);
-    const vguard<TermIndex>& nbrs = relevantNeighbors[term];
+    const vguard<TermIndex>& nbrs = relevantNeighbors[localTermIndex(term)];
+    move.logProposalProb = -log (actives.size());
     if (!nbrs.empty()) {
+      move.logProposalProb -= log (nbrs.size());
       const TermIndex nbr = random_element (nbrs, generator);
-      if (!termState[nbr]) {
+      const LocalTermIndex nbrIndex = localTermIndex (nbr);
+      if (!termState[nbrIndex]) {
 	move.termStates[term] = false;
 	move.termStates[nbr] = true;
-	move.proposalHastingsRatio = nbrs.size() / (double) relevantNeighbors[nbr].size();
+	move.proposalHastingsRatio = nbrs.size() / (double) relevantNeighbors[nbrIndex].size();
       }
     }
   }
@@ -163,10 +430,11 @@ void Model::proposeJumpMove (Move& move, RandomGenerator& generator) const {
   if (!_activeTerms.empty()) {
     const vguard<TermIndex> actives (_activeTerms.begin(), _activeTerms.end());
     const TermIndex term = random_element (actives, generator);
-    const TermIndex nbr = random_element (relevantTerms, generator);
-    if (!termState[nbr]) {
+    const LocalTermIndex nbrIndex = (LocalTermIndex) (random_double(generator) * relevantTerms.size());
+    move.logProposalProb = -log (actives.size()) - log (relevantTerms.size());
+    if (!termState[nbrIndex]) {
       move.termStates[term] = false;
-      move.termStates[nbr] = true;
+      move.termStates[relevantTerms[nbrIndex]] = true;
       move.proposalHastingsRatio = 1;
     }
   }
@@ -177,29 +445,283 @@ void Model::proposeRandomizeMove (Move& move, RandomGenerator& generator) const
     move.termStates[t] = random_double(generator) > .5;
 }
 
-bool Model::sampleMoveCollapsed (Move& move, BernoulliCounts& counts, RandomGenerator& generator) {
-  move.delta = getCountDelta (move.termStates);
+void Model::proposeMove (Move& move, RandomGenerator& generator) const {
+  switch (move.type) {
+  case Flip: proposeFlipMove (move, generator); break;
+  case Step: proposeStepMove (move, generator); break;
+  case Jump: proposeJumpMove (move, generator); break;
+  case Randomize: proposeRandomizeMove (move, generator); break;
+  case MultipleTry: break;  // candidates are generated by sampleMultipleTryMoveCollapsed
+  default: throw runtime_error("Unknown move type"); break;
+  }
+}
+
+void Model::recordTermConditionals (const BernoulliCounts& countsWithPrior) {
+  if (standardParams)
+    recordTermConditionals (StandardParamIndex(), countsWithPrior);
+  else
+    recordTermConditionals (GenericParamIndex (parameterization), countsWithPrior);
+}
+
+template<class ParamIndex>
+void Model::recordTermConditionals (const ParamIndex& index, const BernoulliCounts& countsWithPrior) {
+  for (LocalTermIndex lt = 0; lt < (LocalTermIndex) relevantTerms.size(); ++lt) {
+    typename ParamIndex::Counts delta = index.newCounts();
+    addToggleCountDelta (index, delta, lt);
+    // log-odds of the flipped state against the current one
+    const LogProb flipLogOdds = countsWithPrior.deltaLogBetaBernoulli (delta);
+    termConditionalTotal[lt] += 1 / (1 + exp (termState[lt] ? flipLogOdds : -flipLogOdds));
+  }
+}
+
+bool Model::sampleMoveCollapsed (Move& move, BernoulliCounts& counts, RandomGenerator& generator, double inverseTemperature) {
+  return standardParams
+    ? sampleMoveCollapsed (StandardParamIndex(), move, counts, generator, inverseTemperature)
+    : sampleMoveCollapsed (GenericParamIndex (parameterization), move, counts, generator, inverseTemperature);
+}
+
+template<class ParamIndex>
+bool Model::sampleMoveCollapsed (const ParamIndex& index, Move& move, BernoulliCounts& counts, RandomGenerator& generator, double inverseTemperature) {
+  typename ParamIndex::Counts delta = index.newCounts();
+  addCountDelta (index, delta, move.termStates);
   //  cerr << counts.toJSON(parameterization.params.paramName) << endl;
-  move.logLikelihoodRatio = counts.deltaLogBetaBernoulli (move.delta);
-  move.hastingsRatio = move.proposalHastingsRatio * exp (move.logLikelihoodRatio);
+  move.logLikelihoodRatio = counts.deltaLogBetaBernoulli (delta);
+  move.hastingsRatio = move.proposalHastingsRatio * exp (inverseTemperature * move.logLikelihoodRatio);
   if (move.hastingsRatio >= 1 || random_double(generator) < move.hastingsRatio) {
     setTermStates (move.termStates);
     move.accepted = true;
-    counts += move.delta;
+    counts += delta;
   } else
     move.accepted = false;
+  if (move.keepDelta)
+    move.delta = delta;
   return move.accepted;
 }
 
-void Model::Move::propose (vguard<Model>& models, const vguard<double>& modelWeight, RandomGenerator& generator) {
-  model = &models [random_index (modelWeight, generator)];
-  switch (type) {
-  case Flip: model->proposeFlipMove (*this, generator); break;
-  case Step: model->proposeStepMove (*this, generator); break;
-  case Jump: model->proposeJumpMove (*this, generator); break;
-  case Randomize: model->proposeRandomizeMove (*this, generator); break;
-  default: throw runtime_error("Unknown move type"); break;
+bool Model::sampleMultipleTryMoveCollapsed (Move& move, MoveType tryType, size_t nTries, BernoulliCounts& counts, RandomGenerator& generator, double inverseTemperature) {
+  return standardParams
+    ? sampleMultipleTryMoveCollapsed (StandardParamIndex(), move, tryType, nTries, counts, generator, inverseTemperature)
+    : sampleMultipleTryMoveCollapsed (GenericParamIndex (parameterization), move, tryType, nTries, counts, generator, inverseTemperature);
+}
+
+template<class ParamIndex>
+bool Model::sampleMultipleTryMoveCollapsed (const ParamIndex& index, Move& move, MoveType tryType, size_t nTries, BernoulliCounts& counts, RandomGenerator& generator, double inverseTemperature) {
+  typedef typename ParamIndex::Counts Counts;
+  Assert (tryType == Flip || tryType == Step || tryType == Jump, "Multiple-try moves must be built from flip, step or jump moves");
+  Assert (nTries > 0, "Multiple-try moves need at least one candidate");
+  // propose & score a batch of candidates from the current state.
+  // weights are relative to the current state's probability, so both batches can be compared
+  auto proposeTries = [&] (size_t n, LogProb logWeightOffset, vguard<Move>& tries, vguard<Counts>& deltas, vguard<LogProb>& logWeight) {
+    tries = vguard<Move> (n);
+    deltas = vguard<Counts> (n, index.newCounts());
+    for (size_t i = 0; i < n; ++i) {
+      Move& t = tries[i];
+      t.model = this;
+      t.type = tryType;
+      proposeMove (t, generator);
+      addCountDelta (index, deltas[i], t.termStates);
+    }
+    logWeight = counts.deltaLogBetaBernoulli (deltas);
+    for (size_t i = 0; i < n; ++i)
+      logWeight[i] = inverseTemperature * logWeight[i] + logWeightOffset - tries[i].logProposalProb;
+  };
+
+  vguard<Move> tries;
+  vguard<Counts> deltas;
+  vguard<LogProb> logWeight;
+  proposeTries (nTries, 0, tries, deltas, logWeight);
+  LogProb logForwardWeight = -numeric_limits<double>::infinity();
+  for (auto lw : logWeight)
+    log_accum_exp (logForwardWeight, lw);
+
+  size_t chosen = 0;
+  double r = random_double(generator);
+  for (; chosen + 1 < nTries; ++chosen)
+    if ((r -= exp (logWeight[chosen] - logForwardWeight)) <= 0)
+      break;
+  const Move& y = tries[chosen];
+  const Counts delta = deltas[chosen];
+  move.termStates = y.termStates;
+  if (move.keepDelta)
+    move.delta = delta;
+  move.logLikelihoodRatio = (logWeight[chosen] + y.logProposalProb) / inverseTemperature;
+
+  // move to the chosen candidate, then draw the reference set from there.
+  // the last reference point is the current state, reached by the inverse move
+  const TermStateAssignment inverse = invert (move.termStates);
+  const BernoulliCounts oldCounts (counts);
+  setTermStates (move.termStates);
+  counts += delta;
+
+  vguard<Move> refs;
+  vguard<Counts> refDeltas;
+  vguard<LogProb> refLogWeight;
+  proposeTries (nTries - 1, inverseTemperature * move.logLikelihoodRatio, refs, refDeltas, refLogWeight);
+  LogProb logReverseWeight = -(y.logProposalProb + log (y.proposalHastingsRatio));
+  for (auto lw : refLogWeight)
+    log_accum_exp (logReverseWeight, lw);
+
+  move.proposalHastingsRatio = y.proposalHastingsRatio;
+  move.hastingsRatio = exp (logForwardWeight - logReverseWeight);
+  move.accepted = move.hastingsRatio >= 1 || random_double(generator) < move.hastingsRatio;
+  if (!move.accepted) {
+    setTermStates (inverse);
+    counts = oldCounts;
   }
+  return move.accepted;
+}
+
+BernoulliCounts Model::gibbsSweepUncollapsed (const BernoulliLogParams& logParams, size_t component, bool record, RandomGenerator& generator, StateSetChanges* changes) {
+  if (changes)
+    return gibbsSweepUncollapsed (logParams, component, record, generator, *changes);
+  ModelStateSets sets (*this);
+  return gibbsSweepUncollapsed (logParams, component, record, generator, sets);
+}
+
+template<class StateSets>
+BernoulliCounts Model::gibbsSweepUncollapsed (const BernoulliLogParams& logParams, size_t component, bool record, RandomGenerator& generator, StateSets& sets) {
+  if (isEnumerated (component))
+    return standardParams
+      ? enumerateUncollapsed (StandardParamIndex(), logParams, component, record, generator, sets)
+      : enumerateUncollapsed (GenericParamIndex (parameterization), logParams, component, record, generator, sets);
+  return standardParams
+    ? gibbsSweepUncollapsed (StandardParamIndex(), logParams, componentTerms[component], generator, sets)
+    : gibbsSweepUncollapsed (GenericParamIndex (parameterization), logParams, componentTerms[component], generator, sets);
+}
+
+BernoulliCounts Model::gibbsSweepHubsUncollapsed (const BernoulliLogParams& logParams, RandomGenerator& generator) {
+  ModelStateSets sets (*this);
+  return standardParams
+    ? gibbsSweepUncollapsed (StandardParamIndex(), logParams, hubTerms, generator, sets)
+    : gibbsSweepUncollapsed (GenericParamIndex (parameterization), logParams, hubTerms, generator, sets);
+}
+
+template<class ParamIndex, class StateSets>
+BernoulliCounts Model::gibbsSweepUncollapsed (const ParamIndex& index, const BernoulliLogParams& logParams, const vguard<LocalTermIndex>& lts, RandomGenerator& generator, StateSets& sets) {
+  typename ParamIndex::Counts counts = index.newCounts();
+  for (auto lt : lts) {
+    typename ParamIndex::Counts delta = index.newCounts();
+    addToggleCountDelta (index, delta, lt);
+    const LogProb logFlipOdds = delta.logBernoulli (logParams);
+    if (random_double(generator) < 1 / (1 + exp (-logFlipOdds))) {
+      setTermState (relevantTerms[lt], !termState[lt], sets);
+      counts += delta;
+    }
+  }
+  return counts;
+}
+
+// visits every state of the component in Gray-code order, so that each is one flip from the last,
+// then jumps to a state sampled from the visited states' exact conditional probabilities
+template<class ParamIndex, class StateSets>
+BernoulliCounts Model::enumerateUncollapsed (const ParamIndex& index, const BernoulliLogParams& logParams, size_t component, bool record, RandomGenerator& generator, StateSets& sets) {
+  const vguard<LocalTermIndex>& lts = componentTerms[component];
+  const vguard<LocalGeneIndex>& lgs = componentGenes[component];
+  const size_t nTerms = lts.size(), nStates = ((size_t) 1) << nTerms;
+  Assert (nTerms < 32, "Component has too many terms to enumerate");
+
+  // each state is a bitmask over the component's terms; each gene is active if its mask overlaps the state's,
+  // or if an active hub term covers it (hub terms don't change during the enumeration)
+  uint32_t mask = 0;
+  vguard<uint32_t> geneMask (lgs.size(), 0);
+  for (size_t j = 0; j < nTerms; ++j) {
+    if (termState[lts[j]])
+      mask |= 1 << j;
+    auto geneIter = lgs.begin();
+    for (auto g : assocs.genesByTerm[relevantTerms[lts[j]]]) {
+      geneIter = lower_bound (geneIter, lgs.end(), localGeneIndex(g));
+      geneMask[geneIter - lgs.begin()] |= 1 << j;
+    }
+  }
+  vguard<bool> hubCovered (lgs.size());
+  for (size_t i = 0; i < lgs.size(); ++i) {
+    int nComponentActive = 0;
+    for (size_t j = 0; j < nTerms; ++j)
+      if (geneMask[i] & mask & (1 << j))
+	++nComponentActive;
+    hubCovered[i] = nActiveTermsByGene[lgs[i]] > nComponentActive;
+  }
+
+  typename ParamIndex::Counts counts = index.newCounts();
+  auto flip = [&] (size_t j) -> LogProb {
+    const LocalTermIndex lt = lts[j];
+    typename ParamIndex::Counts delta = index.newCounts();
+    addToggleCountDelta (index, delta, lt);
+    setTermState (relevantTerms[lt], !termState[lt], sets);
+    counts += delta;
+    mask ^= 1 << j;
+    return delta.logBernoulli (logParams);
+  };
+  vguard<uint32_t> stateMask (nStates);
+  vguard<LogProb> logWeight (nStates);
+  stateMask[0] = mask;
+  logWeight[0] = 0;
+  for (size_t s = 1; s < nStates; ++s) {
+    size_t j = 0;
+    while (!(s & (((size_t) 1) << j)))
+      ++j;
+    logWeight[s] = logWeight[s-1] + flip (j);
+    stateMask[s] = mask;
+  }
+
+  const LogProb maxLogWeight = *max_element (logWeight.begin(), logWeight.end());
+  vguard<double> weight (nStates);
+  double total = 0;
+  for (size_t s = 0; s < nStates; ++s)
+    total += (weight[s] = exp (logWeight[s] - maxLogWeight));
+
+  size_t chosen = 0;
+  double r = random_double(generator) * total;
+  for (; chosen + 1 < nStates; ++chosen)
+    if ((r -= weight[chosen]) <= 0)
+      break;
+  const uint32_t diff = mask ^ stateMask[chosen];
+  for (size_t j = 0; j < nTerms; ++j)
+    if (diff & (1 << j))
+      flip (j);
+
+  if (record)
+    for (size_t s = 0; s < nStates; ++s) {
+      const double p = weight[s] / total;
+      for (size_t j = 0; j < nTerms; ++j)
+	if (stateMask[s] & (1 << j))
+	  termExpectedOccupancy[lts[j]] += p;
+      for (size_t i = 0; i < lgs.size(); ++i)
+	if ((hubCovered[i] || (geneMask[i] & stateMask[s])) ? !relevantGeneInSet[lgs[i]] : relevantGeneInSet[lgs[i]])
+	  geneFalseExpectedOccupancy[lgs[i]] += p;
+    }
+
+  return counts;
+}
+
+void Model::applyStateSetChanges (const StateSetChanges& changes) {
+  ModelStateSets sets (*this);
+  for (auto& a : changes.active)
+    sets.setActive (a.first, a.second);
+  for (auto& f : changes.isFalse)
+    sets.setFalse (f.first, f.second);
+}
+
+void Model::endParallelSweep() {
+  deferHubTermGeneCounts = false;
+  for (auto lt : hubTerms) {
+    TermGeneCounts& tgc = termGeneCounts[lt] = TermGeneCounts();
+    auto geneIter = relevantGenes.begin();
+    for (auto g : assocs.genesByTerm[relevantTerms[lt]]) {
+      geneIter = lower_bound (geneIter, relevantGenes.end(), g);
+      const LocalGeneIndex lg = geneIter - relevantGenes.begin();
+      const bool gInSet = relevantGeneInSet[lg];
+      if (nActiveTermsByGene[lg] == 0)
+	++(gInSet ? tgc.uncoveredInSet : tgc.uncoveredOutOfSet);
+      else if (nActiveTermsByGene[lg] == 1)
+	++(gInSet ? tgc.soleInSet : tgc.soleOutOfSet);
+    }
+  }
+}
+
+void Model::Move::propose (vguard<Model>& models, const alias_sampler& modelSampler, RandomGenerator& generator) {
+  model = &models [modelSampler.sample (generator)];
+  model->proposeMove (*this, generator);
 }
 
 string Model::tsaToJSON (const TermStateAssignment& tsa) const {
@@ -2,28 +2,63 @@
 #define MODEL_INCLUDED
 
 #include <iostream>
+#include <cstdint>
 #include "ontology.h"
 #include "assocs.h"
 #include "bernoulli.h"
 #include "stacktrace.h"
+#include "rng.h"
 
 // uncomment to log random numbers
 // #define LOG_RANDOM_NUMBERS
 
+// the default engine is xoshiro256++; define USE_MT19937 to get the Mersenne Twister instead
+#ifdef USE_MT19937
+typedef mt19937 BaseRandomGenerator;
+#else
+typedef Xoshiro256pp BaseRandomGenerator;
+#endif /* USE_MT19937 */
+
 struct Parameterization {
   vguard<BernoulliParamIndex> termPrior, geneFalsePos, geneFalseNeg;
   BernoulliParamSet params;
   Parameterization (const Assocs& assocs);
   int nParams() const { return params.nParams(); }
+  bool hasUniformGeneParams() const;
+  bool isStandard() const;  // just the three parameters t, fp & fn, shared by all terms & genes
+};
+
+// parameter lookups for Model's count updates, used as template policies.
+// the standard model's parameter IDs are compile-time constants & its counts are fixed-size,
+// so counting reduces to integer increments; other parameterizations go through the lookup arrays
+struct StandardParamIndex {
+  enum : BernoulliParamIndex { TermPrior = 0, FalsePos = 1, FalseNeg = 2, NParams = 3 };
+  typedef FixedBernoulliCounts<NParams> Counts;
+  Counts newCounts() const { return Counts(); }
+  BernoulliParamIndex termPrior (Ontology::TermIndex) const { return TermPrior; }
+  BernoulliParamIndex falsePos (Assocs::GeneIndex) const { return FalsePos; }
+  BernoulliParamIndex falseNeg (Assocs::GeneIndex) const { return FalseNeg; }
+};
+
+struct GenericParamIndex {
+  typedef BernoulliCounts Counts;
+  const Parameterization& parameterization;
+  GenericParamIndex (const Parameterization& param) : parameterization(param) { }
+  Counts newCounts() const { return Counts (parameterization.nParams()); }
+  BernoulliParamIndex termPrior (Ontology::TermIndex t) const { return parameterization.termPrior[t]; }
+  BernoulliParamIndex falsePos (Assocs::GeneIndex g) const { return parameterization.geneFalsePos[g]; }
+  BernoulliParamIndex falseNeg (Assocs::GeneIndex g) const { return parameterization.geneFalseNeg[g]; }
 };
 
 #ifdef LOG_RANDOM_NUMBERS
-struct MTLogger : mt19937 {
+template<class Engine>
+struct RandomLogger : Engine {
+  typedef typename Engine::result_type result_type;
   size_t nRnd;
-  MTLogger() : mt19937(), nRnd(0) { }
-  MTLogger(uint_fast32_t seed) : mt19937(seed), nRnd(0) { }
-  uint_fast32_t operator()() {
-    uint_fast32_t r = mt19937::operator()();
+  RandomLogger() : Engine(), nRnd(0) { }
+  RandomLogger(result_type seed) : Engine(seed), nRnd(0) { }
+  result_type operator()() {
+    result_type r = Engine::operator()();
     cerr << "Random number #" << (++nRnd) << ": " << r << endl;
     return r;
   }
@@ -42,23 +77,25 @@ public:
   typedef map<TermIndex,bool> TermStateAssignment;
 
 #ifdef LOG_RANDOM_NUMBERS
-  typedef MTLogger RandomGenerator;
+  typedef RandomLogger<BaseRandomGenerator> RandomGenerator;
 #else
-  typedef mt19937 RandomGenerator;
+  typedef BaseRandomGenerator RandomGenerator;
 #endif /* LOG_RANDOM_NUMBERS */
 
-  enum MoveType : size_t { Flip = 0, Step = 1, Jump = 2, Randomize = 3, TotalMoveTypes };
+  enum MoveType : size_t { Flip = 0, Step = 1, Jump = 2, Randomize = 3, MultipleTry = 4, TotalMoveTypes };
   struct Move {
     size_t samples, totalSamples;
     Model *model;
     MoveType type;
     TermStateAssignment termStates;
+    bool keepDelta;  // if set, the samplers copy the move's count changes into delta, e.g. for logging
     BernoulliCounts delta;
     LogProb logLikelihoodRatio;
     double proposalHastingsRatio, hastingsRatio;
+    LogProb logProposalProb;  // log-probability of proposing this move from the current state
     bool accepted;
-    Move() : proposalHastingsRatio(1) { }
-    void propose (vguard<Model>& models, const vguard<double>& modelWeight, RandomGenerator& generator);
+    Move() : keepDelta(false), proposalHastingsRatio(1), logProposalProb(0) { }
+    void propose (vguard<Model>& models, const alias_sampler& modelSampler, RandomGenerator& generator);
     string toJSON() const;
   };
 
@@ -67,30 +104,127 @@ public:
   const vguard<TermName>& termName;
   const vguard<GeneName>& geneName;
 
+  // per-model state is indexed by compact local IDs, so it scales with the relevant subgraph
+  typedef int LocalTermIndex;  // index into relevantTerms
+  typedef int LocalGeneIndex;  // index into relevantGenes
+
   GeneIndexSet geneSet;
-  vguard<bool> inGeneSet;  // indexed by GeneIndex
-  vguard<bool> isRelevant;  // indexed by TermIndex
-  vguard<TermIndex> relevantTerms;
-  vguard<vguard<TermIndex> > relevantNeighbors;
+  vguard<TermIndex> relevantTerms;  // sorted
+  vguard<GeneIndex> relevantGenes;  // sorted; genes in the set, or annotated to a relevant term
+  vguard<vguard<TermIndex> > relevantNeighbors;  // indexed by LocalTermIndex
+  // connected components of the relevant terms, linked by shared genes; each sorted.
+  // hub terms (ontology roots, & terms equivalent to them) are annotated to every gene in their namespace,
+  // so would link everything into one component: they are left out, & swept on their own.
+  // given the parameters & the hub terms' states, terms in different components are independent
+  vguard<LocalTermIndex> hubTerms;  // sorted
+  vguard<vguard<LocalTermIndex> > componentTerms;
+  vguard<vguard<LocalGeneIndex> > componentGenes;  // sorted; genes annotated to each component's terms
+
+  // the uncollapsed sampler enumerates the states of components with at most this many terms,
+  // rather than Gibbs-sampling them, & estimates their occupancies from the exact conditional marginals
+  size_t maxEnumeratedTerms;
+
+  // counts of a term's genes that are uncovered (no active terms) or covered only by that term
+  struct TermGeneCounts {
+    int uncoveredInSet, uncoveredOutOfSet, soleInSet, soleOutOfSet;
+    TermGeneCounts() : uncoveredInSet(0), uncoveredOutOfSet(0), soleInSet(0), soleOutOfSet(0) { }
+  };
+
+  // changes to activeTerms() & falseGenes() logged by threads sweeping different components,
+  // which can update the per-term & per-gene arrays concurrently but not the shared sets
+  struct StateSetChanges {
+    map<TermIndex,bool> active;
+    map<GeneIndex,bool> isFalse;
+    void setActive (TermIndex t, bool a) { active[t] = a; }
+    void setFalse (GeneIndex g, bool f) { isFalse[g] = f; }
+  };
 
 private:
-  vguard<bool> termState;  // indexed by GeneIndex
-  vguard<int> nActiveTermsByGene;  // indexed by GeneIndex
+  vguard<char> termState;  // indexed by LocalTermIndex; not vector<bool>, so threads can set terms in different components
+  vguard<TermGeneCounts> termGeneCounts;  // indexed by LocalTermIndex
+  bool deferHubTermGeneCounts;  // set during parallel component sweeps; see beginParallelSweep
+  vguard<bool> relevantGeneInSet;  // indexed by LocalGeneIndex
+  vguard<int> nActiveTermsByGene;  // indexed by LocalGeneIndex
+  BernoulliCounts irrelevantGeneCounts;  // genes outside relevantGenes are always inactive & out of set
+  bool uniformGeneParams, standardParams;
 
   set<TermIndex> _activeTerms;
   set<GeneIndex> _falseGenes;
 
+  vguard<uint64_t> termOccupancyTotal, termActiveSince;  // indexed by LocalTermIndex
+  vguard<uint64_t> geneFalseOccupancyTotal, geneFalseSince;  // indexed by LocalGeneIndex
+
+  // for enumerated components: summed conditional marginals over recorded samples
+  vguard<int> termComponent;  // indexed by LocalTermIndex; -1 for hub terms
+  vguard<int> geneComponent;  // indexed by LocalGeneIndex; -1 for genes annotated to no relevant term
+  vguard<double> termExpectedOccupancy;  // indexed by LocalTermIndex
+  vguard<double> geneFalseExpectedOccupancy;  // indexed by LocalGeneIndex
+
+  // Rao-Blackwellized estimates: summed conditional probabilities of each term being active, given all the others
+  vguard<double> termConditionalTotal;  // indexed by LocalTermIndex
+
 public:
+  // occupancy is the number of recorded samples in which a term was active (or a gene false).
+  // it is integrated lazily: an entry is only brought up to date when its state changes,
+  // so recording a sample costs nothing. the sampler must set occupancyClock to its count
+  // of recorded samples before changing any term states
+  uint64_t occupancyClock;
+
   Model (const Assocs& assocs, const Parameterization& param);
   void init (const GeneNameSet& geneNames);
 
+  // replaces the gene set in place, keeping the state of terms that remain relevant,
+  // so that sampling an edited gene set can resume with a short burn-in
+  void updateGeneSet (const GeneNameSet& geneNames);
+  void resetOccupancy();
+
   const TermIndex terms() const { return assocs.ontology.terms(); }
   const GeneIndex genes() const { return assocs.genes(); }
 
+  // local IDs are -1 for terms & genes that are not relevant
+  inline LocalTermIndex localTermIndex (TermIndex t) const {
+    auto iter = lower_bound (relevantTerms.begin(), relevantTerms.end(), t);
+    return (iter == relevantTerms.end() || *iter != t) ? -1 : (LocalTermIndex) (iter - relevantTerms.begin());
+  }
+  inline LocalGeneIndex localGeneIndex (GeneIndex g) const {
+    auto iter = lower_bound (relevantGenes.begin(), relevantGenes.end(), g);
+    return (iter == relevantGenes.end() || *iter != g) ? -1 : (LocalGeneIndex) (iter - relevantGenes.begin());
+  }
+
+  bool isRelevant (TermIndex t) const { return localTermIndex(t) >= 0; }
+  bool inGeneSet (GeneIndex g) const { return geneSet.count(g) > 0; }
+  bool localGeneInSet (LocalGeneIndex lg) const { return relevantGeneInSet[lg]; }
+
+  // approximate heap footprints of the per-model arrays & of the occupancy tables
+  size_t bytes() const;
+  size_t occupancyBytes() const;
+
+  const BernoulliCounts& getIrrelevantGeneCounts() const { return irrelevantGeneCounts; }
   const set<TermIndex>& activeTerms() const { return _activeTerms; }
   const set<GeneIndex>& falseGenes() const { return _falseGenes; }
 
-  bool getTermState (TermIndex t) const { return termState[t]; }
+  bool isLocalGeneFalse (LocalGeneIndex lg) const { return nActiveTermsByGene[lg] > 0 ? !relevantGeneInSet[lg] : relevantGeneInSet[lg]; }
+  uint64_t termOccupancy (LocalTermIndex lt, uint64_t clock) const {
+    return termOccupancyTotal[lt] + (termState[lt] ? clock - termActiveSince[lt] : 0);
+  }
+  uint64_t geneFalseOccupancy (LocalGeneIndex lg, uint64_t clock) const {
+    return geneFalseOccupancyTotal[lg] + (isLocalGeneFalse(lg) ? clock - geneFalseSince[lg] : 0);
+  }
+  double termConditionalSum (LocalTermIndex lt) const { return termConditionalTotal[lt]; }
+  // adds each term's probability of being active given the others, under the collapsed model with these counts
+  void recordTermConditionals (const BernoulliCounts& countsWithPrior);
+
+  // the best available estimates: expected occupancies in enumerated components, sampled ones elsewhere
+  bool isEnumerated (size_t component) const { return componentTerms[component].size() <= maxEnumeratedTerms; }
+  double termOccupancyEstimate (LocalTermIndex lt, uint64_t clock) const {
+    return termComponent[lt] >= 0 && isEnumerated(termComponent[lt]) ? termExpectedOccupancy[lt] : termOccupancy(lt,clock);
+  }
+  double geneFalseOccupancyEstimate (LocalGeneIndex lg, uint64_t clock) const {
+    return geneComponent[lg] >= 0 && isEnumerated(geneComponent[lg]) ? geneFalseExpectedOccupancy[lg] : geneFalseOccupancy(lg,clock);
+  }
+
+  bool getTermState (TermIndex t) const { return termState[localTermIndex(t)]; }
+  const TermGeneCounts& getTermGeneCounts (TermIndex t) const { return termGeneCounts[localTermIndex(t)]; }
   void setTermState (TermIndex t, bool val);
   void setTermStates (const TermStateAssignment& tsa);
 
@@ -103,25 +237,81 @@ public:
   void proposeStepMove (Move& move, RandomGenerator& generator) const;
   void proposeJumpMove (Move& move, RandomGenerator& generator) const;
   void proposeRandomizeMove (Move& move, RandomGenerator& generator) const;
+  void proposeMove (Move& move, RandomGenerator& generator) const;  // dispatches on move.type
 
-  bool sampleMoveCollapsed (Move& move, BernoulliCounts& counts, RandomGenerator& generator);
+  // inverseTemperature scales log-likelihood ratios, for tempered replicas
+  bool sampleMoveCollapsed (Move& move, BernoulliCounts& counts, RandomGenerator& generator, double inverseTemperature = 1);
+  // multiple-try Metropolis (Liu, Liang & Wong, 2000) with nTries candidates of type tryType.
+  // candidates are weighted by pi(y)/q(y|x), which is valid for asymmetric proposals
+  bool sampleMultipleTryMoveCollapsed (Move& move, MoveType tryType, size_t nTries, BernoulliCounts& counts, RandomGenerator& generator, double inverseTemperature = 1);
+  // Gibbs-samples each term of a component given the parameters, or if the component is enumerated,
+  // samples its state exactly, adding its marginals to the expected occupancies if record is set.
+  // if changes is null, activeTerms() & falseGenes() are updated directly; otherwise they are left for applyStateSetChanges
+  BernoulliCounts gibbsSweepUncollapsed (const BernoulliLogParams& logParams, size_t component, bool record, RandomGenerator& generator, StateSetChanges* changes = NULL);
+  // Gibbs-samples the hub terms given the parameters; call between component sweeps, not during them
+  BernoulliCounts gibbsSweepHubsUncollapsed (const BernoulliLogParams& logParams, RandomGenerator& generator);
+  void applyStateSetChanges (const StateSetChanges& changes);
+  // hub terms' genes fall in several components, so threads sweeping those components would race on the hub terms'
+  // gene counts. between these calls the counts are left alone, then recomputed from the genes' active-term counts
+  void beginParallelSweep() { deferHubTermGeneCounts = true; }
+  void endParallelSweep();
 
   string tsaToJSON (const TermStateAssignment& tsa) const;
   
 private:
-  inline void countTerm (BernoulliCounts& counts, int inc, TermIndex t, bool state) const {
+  // ParamIndex is StandardParamIndex or GenericParamIndex
+  template<class ParamIndex>
+  inline void countTerm (const ParamIndex& index, typename ParamIndex::Counts& counts, int inc, TermIndex t, bool state) const {
     auto& countMap = state ? counts.succ : counts.fail;
-    BernoulliParamIndex countParam = parameterization.termPrior[t];
-    countMap[countParam] += inc;
+    countMap[index.termPrior(t)] += inc;
   }
 
-  inline void countObs (BernoulliCounts& counts, int inc, bool isActive, GeneIndex g) const {
-    const bool gInSet = inGeneSet[g],
-      isFalse = isActive ? !gInSet : gInSet;
+  template<class ParamIndex>
+  inline void countObs (const ParamIndex& index, typename ParamIndex::Counts& counts, int inc, bool isActive, bool gInSet, GeneIndex g) const {
+    const bool isFalse = isActive ? !gInSet : gInSet;
     auto& countMap = isFalse ? counts.succ : counts.fail;
-    BernoulliParamIndex countParam = (isActive ? parameterization.geneFalseNeg : parameterization.geneFalsePos)[g];
-    countMap[countParam] += inc;
+    countMap[isActive ? index.falseNeg(g) : index.falsePos(g)] += inc;
   }
+
+  // countObs for a batch of genes, valid only when gene parameters are uniform
+  template<class ParamIndex>
+  inline void countUniformObs (const ParamIndex& index, typename ParamIndex::Counts& counts, int inc, bool isActive, bool gInSet) const {
+    countObs (index, counts, inc, isActive, gInSet, 0);
+  }
+
+  template<class ParamIndex>
+  void addCountDelta (const ParamIndex& index, typename ParamIndex::Counts& cd, const TermStateAssignment& tsa) const;
+  template<class ParamIndex>
+  void addFlipCountDelta (const ParamIndex& index, typename ParamIndex::Counts& cd, LocalTermIndex lt, bool val) const;
+  template<class ParamIndex>
+  void addToggleCountDelta (const ParamIndex& index, typename ParamIndex::Counts& cd, LocalTermIndex lt) const;  // flips term lt
+  template<class ParamIndex>
+  void recordTermConditionals (const ParamIndex& index, const BernoulliCounts& countsWithPrior);
+  template<class ParamIndex>
+  bool sampleMoveCollapsed (const ParamIndex& index, Move& move, BernoulliCounts& counts, RandomGenerator& generator, double inverseTemperature);
+  template<class ParamIndex>
+  bool sampleMultipleTryMoveCollapsed (const ParamIndex& index, Move& move, MoveType tryType, size_t nTries, BernoulliCounts& counts, RandomGenerator& generator, double inverseTemperature);
+
+  // setTermState records active terms & false genes through a StateSets policy: the model's own sets, or a StateSetChanges
+  struct ModelStateSets {
+    Model& model;
+    ModelStateSets (Model& model) : model(model) { }
+    void setActive (TermIndex t, bool a) { if (a) model._activeTerms.insert(t); else model._activeTerms.erase(t); }
+    void setFalse (GeneIndex g, bool f) { if (f) model._falseGenes.insert(g); else model._falseGenes.erase(g); }
+  };
+  template<class StateSets>
+  void setTermState (TermIndex t, bool val, StateSets& sets);
+  template<class StateSets>
+  BernoulliCounts gibbsSweepUncollapsed (const BernoulliLogParams& logParams, size_t component, bool record, RandomGenerator& generator, StateSets& sets);
+  template<class ParamIndex, class StateSets>
+  BernoulliCounts gibbsSweepUncollapsed (const ParamIndex& index, const BernoulliLogParams& logParams, const vguard<LocalTermIndex>& lts, RandomGenerator& generator, StateSets& sets);
+  template<class ParamIndex, class StateSets>
+  BernoulliCounts enumerateUncollapsed (const ParamIndex& index, const BernoulliLogParams& logParams, size_t component, bool record, RandomGenerator& generator, StateSets& sets);
+
+  GeneIndexSet geneNamesToIndices (const GeneNameSet& geneNames) const;
+  void setGeneSet (const GeneIndexSet& newGeneSet);  // requires all terms to be off
+
+  void updateTermGeneCounts (GeneIndex g, bool gInSet, int oldCount, int newCount);
 };
 
 #endif /* MODEL_INCLUDED */
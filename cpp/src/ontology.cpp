@@ -1,6 +1,10 @@
 #include <stdexcept>
 #include <deque>
+#include <list>
+#include <thread>
+#include <algorithm>
 #include "ontology.h"
+#include "util.h"
 #include "regexmacros.h"
 
 vguard<Ontology::TermIndex> Ontology::toposortTermIndex() const {
@@ -50,13 +54,138 @@ void Ontology::init (const TermParentsMap& termParents) {
   }
 }
 
-vguard<set<Ontology::TermIndex> > Ontology::transitiveClosure() const {
-  vguard<set<TermIndex> > tc (terms());
-  auto L = toposortTermIndex();
-  for (TermIndex n : L) {
-    tc[n].insert (n);
+void Ontology::prune (const set<TermName>& seedTerms) {
+  vguard<bool> keep (terms(), false);
+  deque<TermIndex> queue;
+  for (auto& tn : seedTerms) {
+    auto iter = termIndex.find (tn);
+    if (iter != termIndex.end() && !keep[iter->second]) {
+      keep[iter->second] = true;
+      queue.push_back (iter->second);
+    }
+  }
+  while (queue.size()) {
+    const TermIndex t = queue.front();
+    queue.pop_front();
+    for (auto p : parents[t])
+      if (!keep[p]) {
+	keep[p] = true;
+	queue.push_back (p);
+      }
+  }
+
+  // nearest kept ancestors of dropped terms, visiting parents first
+  vguard<set<TermIndex> > keptAncestors (terms());
+  for (TermIndex t : toposortTermIndex())
+    if (!keep[t]) {
+      for (auto p : parents[t])
+	if (keep[p])
+	  keptAncestors[t].insert (p);
+	else
+	  keptAncestors[t].insert (keptAncestors[p].begin(), keptAncestors[p].end());
+    }
+
+  TermParentsMap tp;
+  for (TermIndex t = 0; t < terms(); ++t)
+    if (keep[t]) {
+      set<TermName>& tParents = tp[termName[t]];
+      for (auto p : parents[t])
+	tParents.insert (termName[p]);
+    }
+
+  const vguard<TermName> oldTermName = termName;
+  termName.clear();
+  termIndex.clear();
+  parents.clear();
+  children.clear();
+  init (tp);
+
+  for (TermIndex t = 0; t < (TermIndex) oldTermName.size(); ++t)
+    if (!keep[t]) {
+      vguard<TermIndex>& anc = prunedTermAncestors[oldTermName[t]];
+      for (auto a : keptAncestors[t])
+	anc.push_back (termIndex.at (oldTermName[a]));
+    }
+}
+
+set<string> Ontology::namespaces() const {
+  set<string> ns;
+  for (TermIndex t = 0; t < terms(); ++t) {
+    auto iter = termNamespace.find (termName[t]);
+    if (iter != termNamespace.end())
+      ns.insert (iter->second);
+  }
+  return ns;
+}
+
+Ontology Ontology::namespaceSubgraph (const string& ns) const {
+  if (!prunedTermAncestors.empty())
+    throw std::logic_error ("Namespace subgraphs must be taken before pruning");
+  auto inNamespace = [&] (const TermName& tn) -> bool {
+    auto iter = termNamespace.find (tn);
+    return iter != termNamespace.end() && iter->second == ns;
+  };
+  // edges between namespaces (e.g. part_of) are dropped
+  TermParentsMap tp;
+  for (TermIndex t = 0; t < terms(); ++t)
+    if (inNamespace (termName[t])) {
+      set<TermName>& tParents = tp[termName[t]];
+      for (auto p : parents[t])
+	if (inNamespace (termName[p]))
+	  tParents.insert (termName[p]);
+    }
+
+  Ontology sub;
+  sub.init (tp);
+  for (TermIndex t = 0; t < sub.terms(); ++t)
+    sub.termNamespace[sub.termName[t]] = ns;
+  for (TermIndex t = 0; t < terms(); ++t)
+    if (!inNamespace (termName[t]))
+      sub.prunedTermAncestors[termName[t]] = vguard<TermIndex>();
+  return sub;
+}
+
+size_t Ontology::bytes() const {
+  size_t b = vector_bytes(termName) + map_bytes(termIndex) + vector_bytes(parents) + vector_bytes(children)
+    + map_bytes(prunedTermAncestors) + map_bytes(termNamespace);
+  for (TermIndex t = 0; t < terms(); ++t)
+    b += termName[t].capacity() + vector_bytes(parents[t]) + vector_bytes(children[t]);
+  return b;
+}
+
+vguard<vguard<Ontology::TermIndex> > Ontology::toposortLevels() const {
+  vguard<vguard<TermIndex> > levels;
+  vguard<size_t> level (terms(), 0);
+  for (TermIndex n : toposortTermIndex()) {
     for (TermIndex p : parents[n])
-      tc[n].insert (tc[p].begin(), tc[p].end());
+      level[n] = max (level[n], level[p] + 1);
+    if (level[n] >= levels.size())
+      levels.resize (level[n] + 1);
+    levels[level[n]].push_back (n);
+  }
+  return levels;
+}
+
+vguard<set<Ontology::TermIndex> > Ontology::transitiveClosure (size_t nThreads) const {
+  vguard<set<TermIndex> > tc (terms());
+  // a term's parents are all on earlier levels, so the terms on one level can be closed independently
+  for (const auto& level : toposortLevels()) {
+    auto closeLevel = [&] (size_t first) {
+      for (size_t i = first; i < level.size(); i += nThreads) {
+	const TermIndex n = level[i];
+	tc[n].insert (n);
+	for (TermIndex p : parents[n])
+	  tc[n].insert (tc[p].begin(), tc[p].end());
+      }
+    };
+    if (nThreads > 1 && level.size() > 1) {
+      list<thread> threads;
+      for (size_t t = 0; t < nThreads; ++t)
+	threads.push_back (thread (closeLevel, t));
+      for (auto& thr: threads)
+	thr.join();
+    } else
+      closeLevel (0);
   }
   return tc;
 }
@@ -65,22 +194,27 @@ const regex term_re ("^\\[Term\\]", regex_constants::basic);
 const regex id_re ("^id: " RE_GROUP("GO:" RE_PLUS(RE_NUMERIC_CHAR_CLASS)), regex_constants::basic);
 const regex isa_re ("^is_a: " RE_GROUP("GO:" RE_PLUS(RE_NUMERIC_CHAR_CLASS)), regex_constants::basic);
 const regex relationship_re ("^relationship: part_of " RE_GROUP("GO:" RE_PLUS(RE_NUMERIC_CHAR_CLASS)), regex_constants::basic);
+const regex namespace_re ("^namespace: " RE_GROUP(RE_PLUS(RE_NONWHITE_CHAR_CLASS)), regex_constants::basic);
 const regex obsolete_re ("^is_obsolete", regex_constants::basic);
 
 void Ontology::parseOBO (istream& in) {
   smatch sm;
   TermName id;
+  string ns;
   set<TermName> parents;
   TermParentsMap tp;
   auto clear = [&]() -> void
     {
 	id.clear();
+	ns.clear();
 	parents.clear();
     };
   auto addTerm = [&]() -> void
     {
       if (id.size()) {
 	tp[id] = parents;
+	if (ns.size())
+	  termNamespace[id] = ns;
 	clear();
       }
     };
@@ -91,12 +225,17 @@ void Ontology::parseOBO (istream& in) {
       addTerm();
     else if (regex_search (line, sm, id_re))
       id = sm.str(1);
+    else if (regex_search (line, sm, namespace_re))
+      ns = sm.str(1);
     else if (regex_search (line, sm, isa_re))
       parents.insert (sm.str(1));
     else if (regex_search (line, sm, relationship_re))
       parents.insert (sm.str(1));
-    else if (regex_search (line, obsolete_re))
+    else if (regex_search (line, obsolete_re)) {
+      if (id.size())
+	obsoleteTerms.insert (id);
       clear();
+    }
   }
   addTerm();
   init (tp);
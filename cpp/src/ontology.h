@@ -16,12 +16,28 @@ struct Ontology {
   vguard<TermName> termName;
   map<TermName,TermIndex> termIndex;
   vguard<vguard<TermIndex> > parents, children;
+  map<TermName,vguard<TermIndex> > prunedTermAncestors;  // nearest kept ancestors of each term dropped by prune() or namespaceSubgraph()
+  map<TermName,string> termNamespace;  // from namespace: tags, e.g. biological_process
+  set<TermName> obsoleteTerms;  // from is_obsolete tags; these terms are left out of the graph
 
   TermIndex terms() const { return termName.size(); }
+  size_t bytes() const;  // approximate heap footprint
   vguard<TermIndex> toposortTermIndex() const;
-  vguard<set<TermIndex> > transitiveClosure() const;
+  vguard<vguard<TermIndex> > toposortLevels() const;  // terms grouped by longest path from a root
+  vguard<set<TermIndex> > transitiveClosure (size_t nThreads = 1) const;  // parallel within each level
 
   void init (const TermParentsMap& termParents);
+  bool isPruned (const TermName& term) const { return prunedTermAncestors.count(term) > 0; }
+
+  // keep only the given terms & their ancestors, renumbering the survivors compactly (names are unchanged).
+  // since the kept subgraph is closed under parents, toposort order over it is as before;
+  // annotations to dropped terms should be redirected to their prunedTermAncestors to keep gene counts exact
+  void prune (const set<TermName>& seedTerms);
+
+  // namespaces, and the subgraph for one of them (other terms are treated as pruned, with no kept ancestors).
+  // take subgraphs before pruning, so that pruning never follows edges between namespaces
+  set<string> namespaces() const;
+  Ontology namespaceSubgraph (const string& ns) const;
   void parseOBO (istream& in);
 };
 
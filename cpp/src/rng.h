@@ -0,0 +1,104 @@
+#ifndef RNG_INCLUDED
+#define RNG_INCLUDED
+
+#include <cstdint>
+#include <limits>
+
+/* xoshiro256++ (Blackman & Vigna, http://prng.di.unimi.it/)
+   64-bit output, period 2^256-1, passes BigCrush; much faster than mt19937.
+   Satisfies UniformRandomBitGenerator, so it works with <random> distributions.
+   split() hands back a generator for an independent stream of 2^128 draws,
+   so parallel workers can be given reproducible streams from one seed. */
+class Xoshiro256pp {
+public:
+  typedef uint64_t result_type;
+  static constexpr result_type default_seed = 5489u;
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+  explicit Xoshiro256pp (result_type seed = default_seed) { this->seed (seed); }
+
+  // expand the seed into the state with splitmix64, as recommended by the authors
+  void seed (result_type seed) {
+    for (auto& x : s) {
+      uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      x = z ^ (z >> 31);
+    }
+  }
+
+  result_type operator()() {
+    const uint64_t result = rotl (s[0] + s[3], 23) + s[0];
+    const uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl (s[3], 45);
+    return result;
+  }
+
+  // equivalent to 2^128 calls to operator()
+  void jump() {
+    static const uint64_t JUMP[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+    uint64_t j[4] = { 0, 0, 0, 0 };
+    for (auto jump : JUMP)
+      for (int b = 0; b < 64; ++b) {
+	if (jump & (1ULL << b))
+	  for (int i = 0; i < 4; ++i)
+	    j[i] ^= s[i];
+	(*this)();
+      }
+    for (int i = 0; i < 4; ++i)
+      s[i] = j[i];
+  }
+
+  // returns a generator starting at the current state, then jumps past its stream
+  Xoshiro256pp split() {
+    Xoshiro256pp child (*this);
+    jump();
+    return child;
+  }
+
+  void discard (unsigned long long n) {
+    while (n--)
+      (*this)();
+  }
+
+  bool operator== (const Xoshiro256pp& other) const {
+    for (int i = 0; i < 4; ++i)
+      if (s[i] != other.s[i])
+	return false;
+    return true;
+  }
+  bool operator!= (const Xoshiro256pp& other) const { return !(*this == other); }
+
+private:
+  uint64_t s[4];
+  static inline uint64_t rotl (uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+};
+
+/* split_generator: a generator for an independent stream, advancing the parent.
+   Engines without a jump function are seeded from the parent's next draw */
+template<class Generator>
+Generator split_generator (Generator& generator) {
+  return Generator (generator());
+}
+
+inline Xoshiro256pp split_generator (Xoshiro256pp& generator) {
+  return generator.split();
+}
+
+/* derive_seed: a well-mixed seed for the index'th of a family of independent runs
+   (one splitmix64 step), so each run is reproducible whatever order the runs are done in */
+inline uint64_t derive_seed (uint64_t seed, uint64_t index) {
+  uint64_t z = seed + (index + 1) * 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+#endif /* RNG_INCLUDED */
@@ -0,0 +1,153 @@
+#include <thread>
+#include "simulator.h"
+
+static string namesToJSON (const vguard<string>& names, const vguard<int>& indices) {
+  ostringstream json;
+  json << "[";
+  int n = 0;
+  for (auto i : indices)
+    json << (n++ ? "," : "") << "\"" << names[i] << "\"";
+  json << "]";
+  return json.str();
+}
+
+Assocs::GeneNameSet Simulator::Sample::observedGeneNames (const Assocs& assocs) const {
+  Assocs::GeneNameSet gs;
+  for (auto g : observedGene)
+    gs.push_back (assocs.geneName[g]);
+  return gs;
+}
+
+string Simulator::Sample::toJSON (const Assocs& assocs, const string& inferenceJson) const {
+  return string("{\"term\":") + namesToJSON(assocs.ontology.termName,term)
+    + ",\"gene\":{\"true\":" + namesToJSON(assocs.geneName,trueGene)
+    + ",\"falsePos\":" + namesToJSON(assocs.geneName,falsePosGene)
+    + ",\"falseNeg\":" + namesToJSON(assocs.geneName,falseNegGene)
+    + ",\"observed\":" + namesToJSON(assocs.geneName,observedGene) + "}"
+    + (inferenceJson.empty() ? string() : (",\"inferenceResults\":" + inferenceJson))
+    + "}";
+}
+
+string Simulator::Simulation::paramsToJSON (const BernoulliParamSet& paramSet) const {
+  ostringstream json;
+  json << "{";
+  for (BernoulliParamIndex n = 0; n < paramSet.nParams(); ++n)
+    json << (n ? "," : "") << "\"" << paramSet.paramName[n] << "\":" << params[n];
+  json << "}";
+  return json.str();
+}
+
+vguard<Assocs::GeneNameSet> Simulator::Simulation::observedGeneSets (const Assocs& assocs) const {
+  vguard<Assocs::GeneNameSet> gs;
+  for (auto& sample : samples)
+    gs.push_back (sample.observedGeneNames (assocs));
+  return gs;
+}
+
+Simulator::Simulation Simulator::sampleGeneSets (size_t n, RandomGenerator& generator) const {
+  Simulation sim;
+  sim.params = prior.sampleParams (generator);
+  for (auto& sp : simParams)
+    sim.params[parameterization.params.paramIndex.at(sp.first)] = sp.second;
+
+  const Ontology& ontology = assocs.ontology;
+  vguard<TermIndex> candidateTerms;
+  vguard<set<TermIndex> > closure;
+  if (nActiveTerms) {
+    for (auto t : assocs.relevantTerms())
+      if ((!excludeAncestralTerms || ontology.children[t].empty())
+	  && (!termAssociationCutoff || (int) assocs.genesByTerm[t].size() < termAssociationCutoff))
+	candidateTerms.push_back (t);
+    if (excludeRedundantTerms)
+      closure = ontology.transitiveClosure();
+  } else {
+    // visit relevant terms in topological order, so parents are sampled before children
+    vguard<bool> isRelevant (assocs.terms(), false);
+    for (auto t : assocs.relevantTerms())
+      isRelevant[t] = true;
+    for (auto t : ontology.toposortTermIndex())
+      if (isRelevant[t])
+	candidateTerms.push_back (t);
+  }
+
+  // each gene set gets its own stream, so results do not depend on the number of threads
+  vguard<RandomGenerator> sampleGenerator;
+  for (size_t i = 0; i < n; ++i)
+    sampleGenerator.push_back (split_generator (generator));
+
+  sim.samples.resize (n);
+  auto sampleRange = [&] (size_t first) {
+    for (size_t i = first; i < n; i += nThreads)
+      sim.samples[i] = sampleGeneSet (sim.params, candidateTerms, closure, sampleGenerator[i]);
+  };
+  if (nThreads > 1) {
+    list<thread> threads;
+    for (size_t t = 0; t < nThreads; ++t)
+      threads.push_back (thread (sampleRange, t));
+    for (auto& thr: threads)
+      thr.join();
+  } else
+    sampleRange (0);
+
+  return sim;
+}
+
+Simulator::Sample Simulator::sampleGeneSet (const BernoulliParams& params, const vguard<TermIndex>& candidateTerms, const vguard<set<TermIndex> >& closure, RandomGenerator& generator) const {
+  const Ontology& ontology = assocs.ontology;
+  Sample sample;
+  vguard<bool> termState (assocs.terms(), false);
+  if (nActiveTerms) {
+    vguard<TermIndex> rt (candidateTerms);
+    for (size_t i = 0; i + 1 < rt.size(); ++i) {  // Fisher-Yates shuffle
+      const size_t j = min (rt.size() - 1, i + (size_t) (random_double(generator) * (rt.size() - i)));
+      swap (rt[i], rt[j]);
+    }
+    vguard<bool> termRedundant (assocs.terms(), false);
+    int nTerms = 0;
+    for (size_t n = 0; n < rt.size() && nTerms < nActiveTerms; ++n) {
+      const TermIndex term = rt[n];
+      if (!termRedundant[term]) {
+	termState[term] = true;
+	if (excludeRedundantTerms)
+	  for (auto t : closure[term])
+	    termRedundant[t] = true;
+	++nTerms;
+      }
+    }
+    if (nTerms < nActiveTerms)
+      Warn ("%d simulated terms requested; could only generate %d terms", nActiveTerms, nTerms);
+  } else {
+    vguard<bool> implicitTermState (assocs.terms(), false);
+    for (auto term : candidateTerms) {
+      for (auto p : ontology.parents[term])
+	if (implicitTermState[p])
+	  implicitTermState[term] = true;
+      if (!excludeRedundantTerms || !implicitTermState[term])
+	if (random_double(generator) < params[parameterization.termPrior[term]])
+	  termState[term] = implicitTermState[term] = true;
+    }
+  }
+
+  vguard<bool> geneState (assocs.genes(), false);
+  for (TermIndex t = 0; t < assocs.terms(); ++t)
+    if (termState[t]) {
+      sample.term.push_back (t);
+      for (auto g : assocs.genesByTerm[t])
+	geneState[g] = true;
+    }
+
+  for (GeneIndex g = 0; g < assocs.genes(); ++g) {
+    const bool state = geneState[g];
+    const BernoulliParamIndex falseParam = (state ? parameterization.geneFalseNeg : parameterization.geneFalsePos)[g];
+    const bool isFalse = random_double(generator) < params[falseParam];
+    const bool observed = isFalse ? !state : state;
+    if (state)
+      sample.trueGene.push_back (g);
+    if (observed)
+      sample.observedGene.push_back (g);
+    if (isFalse)
+      (state ? sample.falseNegGene : sample.falsePosGene).push_back (g);
+  }
+
+  return sample;
+}
@@ -0,0 +1,52 @@
+#ifndef SIMULATOR_INCLUDED
+#define SIMULATOR_INCLUDED
+
+#include "model.h"
+
+struct Simulator {
+  typedef Ontology::TermIndex TermIndex;
+  typedef Assocs::GeneIndex GeneIndex;
+  typedef Model::RandomGenerator RandomGenerator;
+
+  struct Sample {
+    vguard<TermIndex> term;
+    vguard<GeneIndex> trueGene, falsePosGene, falseNegGene, observedGene;
+    Assocs::GeneNameSet observedGeneNames (const Assocs& assocs) const;
+    string toJSON (const Assocs& assocs, const string& inferenceJson = string()) const;
+  };
+
+  struct Simulation {
+    BernoulliParams params;
+    vguard<Sample> samples;
+    string paramsToJSON (const BernoulliParamSet& paramSet) const;
+    vguard<Assocs::GeneNameSet> observedGeneSets (const Assocs& assocs) const;
+  };
+
+  const Assocs& assocs;
+  const Parameterization& parameterization;
+  const BernoulliCounts& prior;
+
+  map<BernoulliParamName,double> simParams;  // overrides parameters sampled from the prior
+  int nActiveTerms;  // if zero, sample term states from the term prior
+  bool excludeRedundantTerms, excludeAncestralTerms;
+  int termAssociationCutoff;  // if nonzero, exclude terms with this many genes or more
+  size_t nThreads;
+
+  Simulator (const Assocs& assocs, const Parameterization& parameterization, const BernoulliCounts& prior)
+    : assocs(assocs),
+      parameterization(parameterization),
+      prior(prior),
+      nActiveTerms(0),
+      excludeRedundantTerms(false),
+      excludeAncestralTerms(false),
+      termAssociationCutoff(0),
+      nThreads(1)
+  { }
+
+  Simulation sampleGeneSets (size_t n, RandomGenerator& generator) const;
+
+private:
+  Sample sampleGeneSet (const BernoulliParams& params, const vguard<TermIndex>& candidateTerms, const vguard<set<TermIndex> >& closure, RandomGenerator& generator) const;
+};
+
+#endif /* SIMULATOR_INCLUDED */
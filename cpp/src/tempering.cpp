@@ -0,0 +1,137 @@
+#include <thread>
+#include <condition_variable>
+#include "tempering.h"
+#include "logger.h"
+
+// blocks each caller until all nThreads have arrived, then releases them together; reusable across rounds
+struct RoundBarrier {
+  mutex mx;
+  condition_variable cv;
+  const size_t nThreads;
+  size_t nWaiting, generation;
+  RoundBarrier (size_t nThreads) : nThreads(nThreads), nWaiting(0), generation(0) { }
+  void wait() {
+    unique_lock<mutex> lock (mx);
+    const size_t gen = generation;
+    if (++nWaiting == nThreads) {
+      nWaiting = 0;
+      ++generation;
+      cv.notify_all();
+    } else
+      cv.wait (lock, [&] { return generation != gen; });
+  }
+};
+
+ReplicaExchange::ReplicaExchange (const MCMC& base, size_t nReplicas, double minInverseTemperature)
+  : swapInterval(100),
+    nThreads(1)
+{
+  Assert (base.models.empty(), "Replicas must be created before their models");
+  Assert (nReplicas > 0, "Need at least one replica");
+  Assert (minInverseTemperature > 0 && minInverseTemperature <= 1, "Inverse temperatures must be in (0,1]");
+  for (size_t r = 0; r < nReplicas; ++r) {
+    replicas.emplace_back (base);
+    inverseTemperature.push_back (nReplicas > 1 ? pow (minInverseTemperature, r / (double) (nReplicas - 1)) : 1.);
+    rungReplica.push_back (r);
+  }
+  swapAttempts = swapAccepts = vguard<size_t> (nReplicas - 1, 0);
+  setRungs();
+}
+
+void ReplicaExchange::setRungs() {
+  for (size_t rung = 0; rung < rungReplica.size(); ++rung) {
+    MCMC& replica = replicas[rungReplica[rung]];
+    replica.inverseTemperature = inverseTemperature[rung];
+    replica.recordSamples = (rung == 0);
+  }
+}
+
+void ReplicaExchange::initModels (const vguard<Assocs::GeneNameSet>& geneSets) {
+  for (auto& replica : replicas)
+    replica.initModels (geneSets);
+}
+
+void ReplicaExchange::run (size_t nSamples, RandomGenerator& generator) {
+  if (replicas.size() == 1) {
+    replicas.front().run (nSamples, generator);
+    return;
+  }
+
+  if (coldChain().nVariables == 0) {
+    Warn ("Refusing to run MCMC on a model with no variables");
+    return;
+  }
+
+  // each replica gets its own stream, so results do not depend on the number of threads
+  vguard<RandomGenerator> replicaGenerator;
+  for (auto& replica : replicas) {
+    replica.initSamplers();
+    replicaGenerator.push_back (split_generator (generator));
+  }
+
+  ProgressLog (plog, 1);
+  plog.initProgress ("Replica exchange run (%u replicas, %u models, %u variables, %u threads)", replicas.size(), coldChain().models.size(), coldChain().nVariables, nThreads);
+
+  // each worker thread steps its share of the replicas through every round, meeting the others at a barrier
+  // before & after the swaps, so threads are started once per run rather than once per round.
+  // worker 0 runs on this thread & does the swaps; the first replica times the run, at the granularity of rounds
+  const size_t nWorkers = max ((size_t) 1, min (nThreads, replicas.size()));
+  RoundBarrier barrier (nWorkers);
+  auto runWorker = [&] (size_t worker) {
+    for (size_t start = 0, round = 0; start < nSamples; start += swapInterval, ++round) {
+      const size_t end = min (nSamples, start + swapInterval);
+      for (size_t r = worker; r < replicas.size(); r += nWorkers)
+	for (size_t sample = start; sample < end; ++sample)
+	  replicas[r].step (sample, nSamples, replicaGenerator[r]);
+      barrier.wait();
+      if (worker == 0) {
+	// alternate between even & odd pairs of adjacent rungs
+	for (size_t lo = round % 2; lo + 1 < rungReplica.size(); lo += 2) {
+	  const LogProb llLo = replicas[rungReplica[lo]].currentLogLikelihood(),
+	    llHi = replicas[rungReplica[lo+1]].currentLogLikelihood();
+	  const LogProb logAccept = (inverseTemperature[lo] - inverseTemperature[lo+1]) * (llHi - llLo);
+	  ++swapAttempts[lo];
+	  if (logAccept >= 0 || random_double(generator) < exp (logAccept)) {
+	    swap (rungReplica[lo], rungReplica[lo+1]);
+	    ++swapAccepts[lo];
+	  }
+	}
+	setRungs();
+	replicas.front().updateRunTimer();
+	if (end < nSamples)
+	  plog.logProgress (end / (double) nSamples, "sample %u/%u", end + 1, nSamples);
+      }
+      barrier.wait();
+    }
+  };
+
+  replicas.front().startRunTimer();
+  plog.logProgress (0., "sample %u/%u", 1, nSamples);
+  list<thread> threads;
+  for (size_t w = 1; w < nWorkers; ++w)
+    threads.push_back (thread (runWorker, w));
+  runWorker (0);
+  for (auto& thr: threads)
+    thr.join();
+  replicas.front().stopRunTimer();
+
+  for (size_t lo = 0; lo + 1 < rungReplica.size(); ++lo)
+    LogThisAt(1,"Swap rate between inverse temperatures " << inverseTemperature[lo] << " and " << inverseTemperature[lo+1] << ": " << swapAccepts[lo] << "/" << swapAttempts[lo] << endl);
+}
+
+MCMC::Summary ReplicaExchange::summary (double postProbThreshold, double pValueThreshold) const {
+  return partial(pValueThreshold).summary (postProbThreshold);
+}
+
+MCMC::Partial ReplicaExchange::partial (double pValueThreshold) const {
+  vguard<const MCMC*> chains;
+  for (auto& replica : replicas)
+    chains.push_back (&replica);
+  MCMC::Partial part = MCMC::pooledPartial (chains, pValueThreshold);
+  if (replicas.size() > 1) {
+    part.inverseTemperature = inverseTemperature;
+    part.swapAttempts = vguard<uint64_t> (swapAttempts.begin(), swapAttempts.end());
+    part.swapAccepts = vguard<uint64_t> (swapAccepts.begin(), swapAccepts.end());
+  }
+  return part;
+}
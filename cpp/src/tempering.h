@@ -0,0 +1,36 @@
+#ifndef TEMPERING_INCLUDED
+#define TEMPERING_INCLUDED
+
+#include <deque>
+#include "mcmc.h"
+
+// Replica exchange (parallel tempering) for the collapsed sampler.
+// Each replica is an MCMC at one rung of a geometric ladder of inverse temperatures.
+// Replicas swap rungs rather than states, and only count samples while on the cold rung,
+// so pooling the replicas' occupancies gives the cold chain's.
+struct ReplicaExchange {
+  typedef MCMC::RandomGenerator RandomGenerator;
+
+  deque<MCMC> replicas;  // a deque, since each replica's models refer to its own parameterization
+  vguard<double> inverseTemperature;  // indexed by rung; rung 0 is the cold chain
+  vguard<size_t> rungReplica;  // indexed by rung
+  vguard<size_t> swapAttempts, swapAccepts;  // indexed by the lower rung of each adjacent pair
+  size_t swapInterval;  // steps taken by each replica between swap attempts
+  size_t nThreads;
+
+  // copies the settings (move rates etc.) of a base MCMC that has no models yet
+  ReplicaExchange (const MCMC& base, size_t nReplicas, double minInverseTemperature);
+
+  MCMC& coldChain() { return replicas[rungReplica[0]]; }
+
+  void initModels (const vguard<Assocs::GeneNameSet>& geneSets);
+  void run (size_t nSamples, RandomGenerator& generator);
+
+  MCMC::Summary summary (double postProbThreshold = .01, double pValueThreshold = .05) const;
+  MCMC::Partial partial (double pValueThreshold = .05) const;
+
+private:
+  void setRungs();
+};
+
+#endif /* TEMPERING_INCLUDED */
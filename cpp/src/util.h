@@ -2,8 +2,11 @@
 #define UTIL_INCLUDED
 
 #include <numeric>
+#include <limits>
+#include <cstdint>
 #include <vector>
 #include <map>
+#include <set>
 #include <string>
 #include <sstream>
 #include <iostream>
@@ -126,10 +129,24 @@ std::vector<TV> extract_values(std::map<TK, TV> const& input_map) {
   return retval;
 }    
 
-/* random_double */
+/* approximate heap bytes held by containers, for memory reports.
+   Tree nodes are assumed to carry three pointers & a color word besides the element */
+template<class T>
+size_t vector_bytes (const std::vector<T>& v) { return v.capacity() * sizeof(T); }
+inline size_t vector_bytes (const std::vector<bool>& v) { return v.capacity() / 8; }
+template<class T>
+size_t set_bytes (const std::set<T>& s) { return s.size() * (sizeof(T) + 4 * sizeof(void*)); }
+template<class K,class V>
+size_t map_bytes (const std::map<K,V>& m) { return m.size() * (sizeof(K) + sizeof(V) + 4 * sizeof(void*)); }
+
+/* random_double: uniform on [0,1).
+   Full-range 64-bit engines fill all 53 bits of the mantissa from one draw;
+   narrower engines (e.g. mt19937) give one 32-bit draw's worth of resolution */
 template<class Generator>
 double random_double (Generator& generator) {
-  return generator() / (((double) std::numeric_limits<typename Generator::result_type>::max()) + 1);
+  if (Generator::min() == 0 && Generator::max() == std::numeric_limits<uint64_t>::max())
+    return (generator() >> 11) * (1. / 9007199254740992.);  // 2^-53
+  return (generator() - Generator::min()) / (((double) (Generator::max() - Generator::min())) + 1);
 }
 
 /* random_element */
@@ -141,7 +158,7 @@ const T& random_element (const std::vector<T>& v, Generator& generator) {
 /* random_index */
 template<class T,class Generator>
 size_t random_index (const std::vector<T>& weights, Generator& generator) {
-  const T norm = std::accumulate (weights.begin(), weights.end(), 0);
+  const T norm = std::accumulate (weights.begin(), weights.end(), (T) 0);
   Assert (norm > 0, "Negative weights in random_index");
   T variate = random_double(generator) * norm;
   for (size_t n = 0; n < weights.size(); ++n)
@@ -150,4 +167,57 @@ size_t random_index (const std::vector<T>& weights, Generator& generator) {
   return weights.size();
 }
 
+/* alias_sampler: Walker/Vose alias table for O(1) draws from a fixed discrete distribution.
+   O(n) to build; call init again whenever the weights change */
+class alias_sampler {
+private:
+  std::vector<double> prob;  // probability of keeping each column rather than taking its alias
+  std::vector<size_t> alias;
+public:
+  alias_sampler() { }
+  template<class T> alias_sampler (const std::vector<T>& weights) { init (weights); }
+
+  size_t size() const { return prob.size(); }
+  bool empty() const { return prob.empty(); }
+
+  template<class T>
+  void init (const std::vector<T>& weights) {
+    const size_t n = weights.size();
+    prob = std::vector<double> (n, 0);
+    alias = std::vector<size_t> (n, 0);
+    double norm = 0;
+    for (auto w : weights) {
+      Assert (w >= 0, "Negative weights in alias_sampler");
+      norm += w;
+    }
+    Assert (norm > 0, "Zero total weight in alias_sampler");
+    std::vector<size_t> small, large;
+    for (size_t i = 0; i < n; ++i) {
+      prob[i] = weights[i] * n / norm;
+      (prob[i] < 1 ? small : large).push_back (i);
+    }
+    while (!small.empty() && !large.empty()) {
+      const size_t s = small.back(), l = large.back();
+      small.pop_back();
+      alias[s] = l;
+      prob[l] -= 1 - prob[s];
+      if (prob[l] < 1) {
+	large.pop_back();
+	small.push_back (l);
+      }
+    }
+    // anything left over is 1, up to rounding error
+    for (auto i : small) prob[i] = 1;
+    for (auto i : large) prob[i] = 1;
+  }
+
+  // one variate picks both the column & the coin flip, so each draw consumes a single random number
+  template<class Generator>
+  size_t sample (Generator& generator) const {
+    const double u = random_double(generator) * prob.size();
+    const size_t i = std::min ((size_t) u, prob.size() - 1);
+    return (u - i < prob[i]) ? i : alias[i];
+  }
+};
+
 #endif /* UTIL_INCLUDED */
@@ -0,0 +1,190 @@
+#include <thread>
+#include <gsl/gsl_sf_psi.h>
+#include "variational.h"
+#include "logger.h"
+
+// keeps log(1-q) finite
+const double minTermProb = 1e-10;
+
+MeanField::MeanField (const MCMC& mcmc)
+  : mcmc(mcmc),
+    termGenes(mcmc.models.size()),
+    termProb(mcmc.models.size()),
+    termStep(mcmc.models.size()),
+    termLastChange(mcmc.models.size()),
+    geneInactiveLogProb(mcmc.models.size()),
+    maxSweeps(100),
+    sweeps(0),
+    tolerance(1e-3),
+    maxChange(0),
+    minStep(.05),
+    nThreads(1)
+{
+  for (ModelIndex m = 0; m < mcmc.models.size(); ++m) {
+    const Model& model = mcmc.models[m];
+    for (auto t : model.relevantTerms) {
+      vguard<LocalGeneIndex> genes;
+      for (auto g : mcmc.assocs.genesByTerm[t])
+	genes.push_back (model.localGeneIndex (g));
+      termGenes[m].push_back (genes);
+      termProb[m].push_back (model.getTermState(t) ? 1 - minTermProb : minTermProb);
+    }
+    termStep[m] = vguard<double> (model.relevantTerms.size(), .5);
+    termLastChange[m] = vguard<double> (model.relevantTerms.size(), 0.);
+    geneInactiveLogProb[m] = vguard<double> (model.relevantGenes.size());
+  }
+  updateGenes();
+  updateCounts();
+}
+
+void MeanField::runThreads (function<void(size_t)> work) const {
+  if (nThreads > 1) {
+    list<thread> threads;
+    for (size_t t = 0; t < nThreads; ++t)
+      threads.push_back (thread (work, t));
+    for (auto& thr: threads)
+      thr.join();
+  } else
+    work (0);
+}
+
+void MeanField::updateGenes() {
+  runThreads ([&] (size_t first) {
+      for (ModelIndex m = first; m < termProb.size(); m += nThreads) {
+	auto& logInactive = geneInactiveLogProb[m];
+	fill (logInactive.begin(), logInactive.end(), 0.);
+	for (LocalTermIndex lt = 0; lt < (LocalTermIndex) termProb[m].size(); ++lt) {
+	  const double logOff = log (1 - termProb[m][lt]);
+	  for (auto lg : termGenes[m][lt])
+	    logInactive[lg] += logOff;
+	}
+      }
+    });
+}
+
+// expected counts, as Model::getCounts would give them, summed over models
+void MeanField::updateCounts() {
+  const GenericParamIndex index (mcmc.parameterization);
+  BernoulliCounts counts (mcmc.prior);
+  for (ModelIndex m = 0; m < termProb.size(); ++m) {
+    const Model& model = mcmc.models[m];
+    counts += model.getIrrelevantGeneCounts();
+    for (LocalTermIndex lt = 0; lt < (LocalTermIndex) termProb[m].size(); ++lt) {
+      const BernoulliParamIndex p = index.termPrior (model.relevantTerms[lt]);
+      counts.succ[p] += termProb[m][lt];
+      counts.fail[p] += 1 - termProb[m][lt];
+    }
+    for (LocalGeneIndex lg = 0; lg < (LocalGeneIndex) model.relevantGenes.size(); ++lg) {
+      const Assocs::GeneIndex g = model.relevantGenes[lg];
+      const double inactive = exp (geneInactiveLogProb[m][lg]), active = 1 - inactive;
+      const BernoulliParamIndex fn = index.falseNeg(g), fp = index.falsePos(g);
+      if (model.localGeneInSet(lg)) {
+	counts.fail[fn] += active;
+	counts.succ[fp] += inactive;
+      } else {
+	counts.succ[fn] += active;
+	counts.fail[fp] += inactive;
+      }
+    }
+  }
+  expectedCountsWithPrior = counts;
+}
+
+void MeanField::run() {
+  const GenericParamIndex index (mcmc.parameterization);
+  ProgressLog (plog, 1);
+  plog.initProgress ("Mean-field variational inference (%u models, %u variables)", mcmc.models.size(), mcmc.nVariables);
+
+  // every term of every model, so that threads share the work evenly
+  vguard<pair<ModelIndex,LocalTermIndex> > allTerms;
+  for (ModelIndex m = 0; m < termProb.size(); ++m)
+    for (LocalTermIndex lt = 0; lt < (LocalTermIndex) termProb[m].size(); ++lt)
+      allTerms.push_back (make_pair (m, lt));
+
+  for (sweeps = 0; sweeps < maxSweeps; ) {
+    plog.logProgress (sweeps / (double) maxSweeps, "sweep %u/%u", sweeps + 1, maxSweeps);
+
+    // expected log-probabilities under the Beta distributions, as in Model, with uniform priors implicit
+    const BernoulliCounts& c = expectedCountsWithPrior;
+    vguard<double> logP (c.nParams()), logNotP (c.nParams());
+    for (size_t n = 0; n < c.nParams(); ++n) {
+      const double psiSum = gsl_sf_psi (c.succ[n] + c.fail[n] + 2);
+      logP[n] = gsl_sf_psi (c.succ[n] + 1) - psiSum;
+      logNotP[n] = gsl_sf_psi (c.fail[n] + 1) - psiSum;
+    }
+
+    // a term changes the likelihood of a gene's observation only if no other term activates it
+    vguard<vguard<double> > newTermProb (termProb);
+    vguard<double> threadMaxChange (nThreads, 0.);
+    runThreads ([&] (size_t first) {
+	for (size_t n = first; n < allTerms.size(); n += nThreads) {
+	  const ModelIndex m = allTerms[n].first;
+	  const LocalTermIndex lt = allTerms[n].second;
+	  const Model& model = mcmc.models[m];
+	  const double q = termProb[m][lt], logOff = log (1 - q);
+	  const BernoulliParamIndex tp = index.termPrior (model.relevantTerms[lt]);
+	  double logOdds = logP[tp] - logNotP[tp];
+	  for (auto lg : termGenes[m][lt]) {
+	    const Assocs::GeneIndex g = model.relevantGenes[lg];
+	    const BernoulliParamIndex fn = index.falseNeg(g), fp = index.falsePos(g);
+	    const double logActiveMinusInactive = model.localGeneInSet(lg) ? (logNotP[fn] - logP[fp]) : (logP[fn] - logNotP[fp]);
+	    logOdds += exp (geneInactiveLogProb[m][lg] - logOff) * logActiveMinusInactive;
+	  }
+	  const double target = 1 / (1 + exp (-logOdds));
+	  double& step = termStep[m][lt];
+	  double& lastChange = termLastChange[m][lt];
+	  step = (target - q) * lastChange < 0 ? max (minStep, step / 2) : min (1., step * 1.5);
+	  const double newQ = min (1 - minTermProb, max (minTermProb, q + step * (target - q)));
+	  lastChange = newQ - q;
+	  newTermProb[m][lt] = newQ;
+	  threadMaxChange[first] = max (threadMaxChange[first], abs (newQ - q));
+	}
+      });
+    termProb.swap (newTermProb);
+    updateGenes();
+    updateCounts();
+
+    ++sweeps;
+    maxChange = *max_element (threadMaxChange.begin(), threadMaxChange.end());
+    LogThisAt(2,"Sweep #" << sweeps << ": maximum change in term probability " << maxChange << endl);
+    if (maxChange < tolerance)
+      break;
+  }
+  if (maxChange >= tolerance)
+    Warn ("Mean-field approximation did not converge in %u sweeps (maximum change %g)", sweeps, maxChange);
+  else
+    LogThisAt(1,"Mean-field approximation converged in " << plural(sweeps,"sweep") << endl);
+}
+
+MCMC::Summary MeanField::summary (double postProbThreshold, double pValueThreshold) const {
+  MCMC::Summary summ;
+  summ.params = mcmc.params;
+  summ.prior = mcmc.prior;
+  summ.moveRate = mcmc.moveRate;
+  const Assocs& assocs = mcmc.assocs;
+  const auto equiv = assocs.termEquivalents();
+  for (ModelIndex m = 0; m < termProb.size(); ++m) {
+    const Model& model = mcmc.models[m];
+    MCMC::GeneSetSummary gss;
+    for (LocalTermIndex lt = 0; lt < (LocalTermIndex) termProb[m].size(); ++lt)
+      if (termProb[m][lt] >= postProbThreshold) {
+	const Ontology::TermName& tn = assocs.ontology.termName[model.relevantTerms[lt]];
+	gss.termPosterior[tn] = termProb[m][lt];
+	if (equiv.count(tn))
+	  summ.termEquivalents[tn] = equiv.at(tn);
+      }
+    for (LocalGeneIndex lg = 0; lg < (LocalGeneIndex) model.relevantGenes.size(); ++lg) {
+      const bool inSet = model.localGeneInSet(lg);
+      const double inactive = exp (geneInactiveLogProb[m][lg]), pFalse = inSet ? inactive : (1 - inactive);
+      if (pFalse >= postProbThreshold)
+	(inSet ? gss.geneFalsePosPosterior : gss.geneFalseNegPosterior) [assocs.geneName[model.relevantGenes[lg]]] = pFalse;
+    }
+    gss.hypergeometricPValue = assocs.hypergeometricPValues (mcmc.geneSets[m], pValueThreshold);
+    summ.geneSetSummary.push_back (gss);
+  }
+  return summ;
+}
+
+string MeanField::statsToJSON() const {
+  return string("\"variational\":{\"sweeps\":") + to_string(sweeps) + ",\"converged\":" + (maxChange < tolerance ? "true" : "false") + ",\"maxChange\":" + to_string(maxChange) + "}";
+}
@@ -0,0 +1,44 @@
+#ifndef VARIATIONAL_INCLUDED
+#define VARIATIONAL_INCLUDED
+
+#include "mcmc.h"
+
+// Mean-field variational approximation to the collapsed model, as a fast alternative to sampling.
+// Each term is independently active with probability q, & each parameter has a Beta distribution
+// given the expected counts; both are updated by coordinate ascent.
+// Terms are updated together from the previous sweep's state, so the result does not depend on the
+// number of threads. Overlapping terms would then oscillate, so each term's step towards its update
+// is halved whenever the step changes direction, & grown otherwise.
+// The MCMC supplies the models (relevant terms & genes) & the parameterization, & is not modified
+struct MeanField {
+  typedef MCMC::ModelIndex ModelIndex;
+  typedef Model::LocalTermIndex LocalTermIndex;
+  typedef Model::LocalGeneIndex LocalGeneIndex;
+
+  const MCMC& mcmc;
+  vguard<vguard<vguard<LocalGeneIndex> > > termGenes;  // indexed by ModelIndex & LocalTermIndex
+
+  vguard<vguard<double> > termProb;  // q(term active), indexed by ModelIndex & LocalTermIndex
+  vguard<vguard<double> > termStep, termLastChange;  // damping, indexed by ModelIndex & LocalTermIndex
+  vguard<vguard<double> > geneInactiveLogProb;  // log q(gene inactive), indexed by ModelIndex & LocalGeneIndex
+  BernoulliCounts expectedCountsWithPrior;
+
+  size_t maxSweeps, sweeps;
+  double tolerance, maxChange;  // converged when no term's q changes by more than tolerance
+  double minStep;  // lower bound on each term's damped step
+  size_t nThreads;
+
+  // starts from the MCMC's current term states
+  MeanField (const MCMC& mcmc);
+
+  void run();
+  MCMC::Summary summary (double postProbThreshold = .01, double pValueThreshold = .05) const;
+  string statsToJSON() const;
+
+private:
+  void updateGenes();
+  void updateCounts();
+  void runThreads (function<void(size_t)> work) const;
+};
+
+#endif /* VARIATIONAL_INCLUDED */
@@ -0,0 +1,107 @@
+#include <sstream>
+#include <iostream>
+#include "../src/ontology.h"
+#include "../src/assocs.h"
+#include "../src/model.h"
+#include "../src/mcmc.h"
+
+// checks that threaded uncollapsed sweeps leave every term's gene counts as a recount from the term states would,
+// & the same term states as a single-threaded run; the ontology's root is a hub term shared by all the components
+
+const int nBranches = 16, nLeavesPerBranch = 8, nGenesPerLeaf = 100, nSweeps = 200;
+
+string termName (int n) {
+  ostringstream s;
+  s << "GO:" << (1000000 + n);
+  return s.str();
+}
+
+// the root is term 0; branch b is term 1+b; its leaves follow the branches
+string ontologyOBO() {
+  ostringstream obo;
+  obo << "[Term]\nid: " << termName(0) << "\nnamespace: biological_process\n\n";
+  for (int b = 0; b < nBranches; ++b) {
+    obo << "[Term]\nid: " << termName(1+b) << "\nnamespace: biological_process\nis_a: " << termName(0) << " ! root\n\n";
+    for (int l = 0; l < nLeavesPerBranch; ++l)
+      obo << "[Term]\nid: " << termName(1+nBranches+b*nLeavesPerBranch+l) << "\nnamespace: biological_process\nis_a: " << termName(1+b) << " ! branch\n\n";
+  }
+  return obo.str();
+}
+
+// each gene is annotated to one leaf; every third gene is in the set
+string assocsGAF (Assocs::GeneNameSet& geneSet) {
+  ostringstream gaf;
+  for (int leaf = 0; leaf < nBranches * nLeavesPerBranch; ++leaf)
+    for (int n = 0; n < nGenesPerLeaf; ++n) {
+      ostringstream gene;
+      gene << "gene" << leaf << "_" << n;
+      gaf << "DB\t" << gene.str() << "\t" << gene.str() << "\t\t" << termName(1+nBranches+leaf) << "\tREF\tIEA\t\tP\t\t\tgene\ttaxon:1\t20200101\tDB\n";
+      if ((leaf * nGenesPerLeaf + n) % 3 == 0)
+	geneSet.push_back (gene.str());
+    }
+  return gaf.str();
+}
+
+int countMismatches (const Assocs& assocs, const Model& model) {
+  int mismatches = 0;
+  for (auto t : model.relevantTerms) {
+    Model::TermGeneCounts tgc;
+    for (auto g : assocs.genesByTerm[t]) {
+      int nActive = 0;
+      for (auto u : assocs.termsByGene[g])
+	if (binary_search (model.relevantTerms.begin(), model.relevantTerms.end(), u) && model.getTermState(u))
+	  ++nActive;
+      const bool gInSet = model.inGeneSet(g);
+      if (nActive == 0)
+	++(gInSet ? tgc.uncoveredInSet : tgc.uncoveredOutOfSet);
+      else if (nActive == 1)
+	++(gInSet ? tgc.soleInSet : tgc.soleOutOfSet);
+    }
+    const Model::TermGeneCounts& actual = model.getTermGeneCounts(t);
+    if (actual.uncoveredInSet != tgc.uncoveredInSet || actual.uncoveredOutOfSet != tgc.uncoveredOutOfSet
+	|| actual.soleInSet != tgc.soleInSet || actual.soleOutOfSet != tgc.soleOutOfSet) {
+      cerr << "Term " << assocs.ontology.termName[t] << ": gene counts differ from a recount" << endl;
+      ++mismatches;
+    }
+  }
+  return mismatches;
+}
+
+int main (int argc, char** argv) {
+  Ontology ontology;
+  istringstream obo (ontologyOBO());
+  ontology.parseOBO (obo);
+
+  Assocs assocs (ontology);
+  vguard<Assocs::GeneNameSet> geneSets (1);
+  istringstream gaf (assocsGAF (geneSets[0]));
+  assocs.parseGOA (gaf);
+
+  Parameterization parameterization (assocs);
+  BernoulliCounts prior (parameterization.nParams());
+  for (size_t n = 0; n < prior.nParams(); ++n)
+    prior.succ[n] = prior.fail[n] = 1;
+
+  auto run = [&] (size_t nThreads) -> vguard<MCMC::TermIndex> {
+    MCMC mcmc (assocs, parameterization.params, prior);
+    mcmc.nThreads = nThreads;
+    mcmc.initModels (geneSets);
+    Model::RandomGenerator generator (1);
+    mcmc.runUncollapsed (nSweeps, generator);
+    const Model& model = mcmc.models[0];
+    if (model.hubTerms.empty() || model.componentTerms.size() < 2) {
+      cerr << "Expected a hub term & several components, got " << model.hubTerms.size() << " & " << model.componentTerms.size() << endl;
+      exit (1);
+    }
+    if (countMismatches (assocs, model))
+      exit (1);
+    return vguard<MCMC::TermIndex> (model.activeTerms().begin(), model.activeTerms().end());
+  };
+
+  if (run(1) != run(4)) {
+    cerr << "Threaded run ended in different term states from a single-threaded run" << endl;
+    return 1;
+  }
+  cout << "ok" << endl;
+  return 0;
+}
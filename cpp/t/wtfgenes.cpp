@@ -1,25 +1,144 @@
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include <stdexcept>
 #include <boost/program_options.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
 #include "../src/ontology.h"
 #include "../src/assocs.h"
 #include "../src/bernoulli.h"
 #include "../src/model.h"
 #include "../src/mcmc.h"
+#include "../src/tempering.h"
+#include "../src/variational.h"
+#include "../src/index.h"
+#include "../src/simulator.h"
+#include "../src/benchmarker.h"
 #include "../src/logger.h"
 
 namespace po = boost::program_options;
+namespace pt = boost::property_tree;
+
+// read benchmark results (e.g. sim.json from a previous run) back into a Benchmarker
+void readBenchmarkJSON (Benchmarker& benchmarker, const string& path) {
+  pt::ptree tree;
+  pt::read_json (path, tree);
+  auto termProb = [] (const pt::ptree& t) -> Assocs::TermProb {
+    Assocs::TermProb tp;
+    for (auto& kv : t)
+      tp[kv.first] = kv.second.get_value<double>();
+    return tp;
+  };
+  for (auto& bd : tree.get_child("benchmark")) {
+    Benchmarker::Dataset ds;
+    for (auto& sample : bd.second.get_child("simulation.samples")) {
+      vguard<Ontology::TermIndex> trueTerms;
+      for (auto& t : sample.second.get_child("term")) {
+	const string name = t.second.get_value<string>();
+	if (benchmarker.ontology.termIndex.count (name))
+	  trueTerms.push_back (benchmarker.ontology.termIndex.at (name));
+	else
+	  Warn ("Term %s not found in the ontology", name.c_str());
+      }
+      ds.trueTerms.push_back (trueTerms);
+      const pt::ptree& inf = sample.second.get_child("inferenceResults");
+      ds.hypergeometricPValue.push_back (benchmarker.termScores (termProb (inf.get_child("hypergeometricPValue.term"))));
+      ds.termPosterior.push_back (benchmarker.termScores (termProb (inf.get_child("posteriorMarginal.term"))));
+    }
+    benchmarker.datasets.push_back (ds);
+  }
+}
+
+// read the terms with posterior >= minPosterior for each gene set of a previous run's output
+vguard<vguard<Ontology::TermName> > readWarmStartJSON (const string& path, double minPosterior = .5) {
+  pt::ptree tree;
+  pt::read_json (path, tree);
+  vguard<vguard<Ontology::TermName> > terms;
+  for (auto& gss : tree.get_child("summary")) {
+    terms.push_back (vguard<Ontology::TermName>());
+    for (auto& kv : gss.second.get_child("posteriorMarginal.term"))
+      if (kv.second.get_value<double>() >= minPosterior)
+	terms.back().push_back (kv.first);
+  }
+  return terms;
+}
+
+// wtfgenes merge: pool the partial results of runs sharded by seed or by gene set
+int mergePartials (int argc, char** argv) {
+  po::options_description desc("Allowed options for wtfgenes merge");
+  desc.add_options()
+    ("help,h", "display this help message")
+    ("inputs", po::value<vector<string> >(), "partial result files")
+    ("partial,y", po::value<string>(), "also save the merged partial result to this file")
+    ("post-prob,q", po::value<double>()->default_value(.01), "report posteriors at or above this probability")
+    ("verbose,v", po::value<int>()->default_value(1), "verbosity level")
+    ;
+  po::positional_options_description pos;
+  pos.add ("inputs", -1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+  po::notify(vm);
+
+  logger.setVerbose (vm["verbose"].as<int>());
+
+  if (vm.count("help") || !vm.count("inputs")) {
+    cout << "Usage: wtfgenes merge [options] partial1 [partial2...]\n" << desc << "\n";
+    return 1;
+  }
+
+  MCMC::Partial merged;
+  for (auto& path : vm["inputs"].as<vector<string> >()) {
+    ifstream in (path, ios::binary);
+    if (!in)
+      Abort ("File not found: %s", path.c_str());
+    MCMC::Partial part;
+    part.read (in);
+    merged.merge (part);
+    LogThisAt(1,"Merged " << plural(part.geneSetPartial.size(),"gene set") << " from " << path << endl);
+  }
+  if (vm.count("partial")) {
+    ofstream out (vm["partial"].as<string>(), ios::binary);
+    merged.write (out);
+  }
+
+  // named gene sets came from batch mode, & are output the same way
+  const double postProb = vm["post-prob"].as<double>();
+  if (merged.geneSetPartial.size() && merged.geneSetPartial.front().name.size())
+    for (size_t n = 0; n < merged.geneSetPartial.size(); ++n) {
+      MCMC::Partial one = merged;
+      one.geneSetPartial = vguard<MCMC::GeneSetPartial> (1, merged.geneSetPartial[n]);
+      string name;
+      write_quoted_escaped (merged.geneSetPartial[n].name, back_inserter (name));
+      cout << "{\"index\":" << n << ",\"name\":" << name << ",\"result\":" << one.summary(postProb).toJSON() << "}" << endl;
+    }
+  else {
+    cout << merged.summary(postProb).toJSON() << endl;
+  }
+  return 0;
+}
 
 int main (int argc, char** argv) {
 
   try {
+    if (argc > 1 && string(argv[1]) == "merge")
+      return mergePartials (argc - 1, argv + 1);
+
     // Declare the supported options.
     po::options_description desc("Allowed options");
     desc.add_options()
       ("help,h", "display this help message")
       ("ontology,o", po::value<string>(), "path to ontology file")
       ("assocs,a", po::value<string>(), "path to gene-term association file")
+      ("index,I", po::value<string>(), "load ontology & associations from a binary index, instead of -o & -a")
+      ("save-index,f", po::value<string>(), "save a binary index of the ontology & associations (without gene sets, just index)")
+      ("update-index,d", po::value<string>(), "build the index by updating a previous release's binary index, recomputing only what changed")
+      ("prune,G", po::value<string>(), "before closure, prune ontology to terms annotated to any gene ('annotated') or to genes in the gene sets ('genes'), plus their ancestors")
+      ("by-namespace,D", "analyze each ontology namespace (e.g. biological_process) separately & concurrently")
       ("genes,g", po::value<vector<string> >(), "path to gene-set file(s)")
+      ("gmt,c", po::value<string>(), "batch mode: analyze each gene set in a GMT file separately, writing one JSON result per line as each finishes")
       ("samples,s", po::value<int>()->default_value(100), "number of samples per term")
       ("burn,u", po::value<int>()->default_value(10), "burn-in samples per term")
       ("term-prob,t", po::value<double>()->default_value(.5), "mode of term probability prior")
@@ -32,6 +151,41 @@ int main (int argc, char** argv) {
       ("step-rate,S", po::value<double>()->default_value(1), "relative rate of term-stepping moves")
       ("jump-rate,J", po::value<double>()->default_value(1), "relative rate of term-jumping moves")
       ("randomize-rate,R", po::value<double>()->default_value(0), "relative rate of term-randomizing moves")
+      ("adapt-rates", "tune the move rates during burn-in for the most accepted moves per second, & report them")
+      ("multi-try-rate,M", po::value<double>()->default_value(0), "relative rate of multiple-try Metropolis moves")
+      ("multi-tries,K", po::value<int>()->default_value(4), "number of candidates per multiple-try move")
+      ("multi-try-type,Y", po::value<string>()->default_value("flip"), "candidate type for multiple-try moves (flip, step or jump)")
+      ("init-terms,i", po::value<vector<string> >(), "specify initial state as comma-separated term list (one per gene set; overrides --warm-start for that gene set)")
+      ("warm-start,W", po::value<string>(), "initialize each gene set's terms from a previous run's output (posterior >= .5)")
+      ("edit-genes,e", po::value<vector<string> >(), "after sampling, edit each gene set in place to the genes in these files & resume sampling")
+      ("replicas,Q", po::value<int>()->default_value(1), "number of replicas for replica exchange (parallel tempering)")
+      ("hottest,H", po::value<double>()->default_value(.1), "inverse temperature of hottest replica")
+      ("swap-every,L", po::value<int>()->default_value(100), "steps taken by each replica between swap attempts")
+      ("uncollapsed,U", "sample parameters explicitly, alternating with Gibbs sweeps over terms")
+      ("rao-blackwell,j", po::value<int>(), "also estimate term posteriors by averaging their conditional probabilities, every N steps per term")
+      ("enumerate-max", po::value<int>()->default_value(0), "uncollapsed sampler: enumerate the states of unlinked groups of at most this many terms exactly (0 = off)")
+      ("map,l", po::value<string>(), "instead of sampling, search for the most probable term states by simulated annealing ('anneal') or greedy hill-climbing ('greedy')")
+      ("map-steps", po::value<int>()->default_value(10), "moves per term per restart of the MAP search")
+      ("restarts", po::value<int>()->default_value(4), "number of restarts of the MAP search (all but the first from random states)")
+      ("anneal-from", po::value<double>()->default_value(1), "initial inverse temperature for annealing")
+      ("anneal-to", po::value<double>()->default_value(100), "final inverse temperature for annealing")
+      ("variational,V", "instead of sampling, approximate the posterior by mean-field variational inference")
+      ("vb-sweeps", po::value<int>()->default_value(100), "maximum number of variational coordinate-ascent sweeps")
+      ("vb-tolerance", po::value<double>()->default_value(1e-3), "stop when no term probability changes by more than this in a sweep")
+      ("threads,k", po::value<int>()->default_value(1), "number of threads (uncollapsed sampler, replica exchange, simulation, batch mode)")
+      ("simulate,m", po::value<int>(), "instead of doing inference, simulate N gene sets")
+      ("exclude-redundant,x", "exclude redundant terms from simulation")
+      ("exclude-ancestral,X", "exclude ancestral terms from simulation")
+      ("exclude-with,w", po::value<int>(), "exclude terms with >=N gene associations from simulation")
+      ("active-terms,A", po::value<int>(), "specify number of active terms for simulation")
+      ("false-pos,O", po::value<double>(), "specify false positive probability for simulation")
+      ("false-neg,E", po::value<double>(), "specify false negative probability for simulation")
+      ("benchmark,b", "benchmark by running inference on simulated data")
+      ("bench-reps,B", po::value<int>(), "number of repetitions of benchmark")
+      ("bench-csv,C", po::value<string>(), "write hypergeometric.csv & model.csv benchmark tables to this directory")
+      ("reanalyze,z", po::value<string>(), "reanalyze benchmark results from a previous run")
+      ("stats,Z", po::value<string>(), "write timing & memory statistics as JSON to this file ('-' to include them in the output)")
+      ("partial,y", po::value<string>(), "also save raw sample counts to this file, for pooling shards with 'wtfgenes merge'")
       ("rnd-seed,r", po::value<int>()->default_value(123456789), "seed random number generator")
       ("verbose,v", po::value<int>()->default_value(1), "verbosity level")
       ;
@@ -47,28 +201,117 @@ int main (int argc, char** argv) {
       return 1;
     }
 
+    const size_t nThreads = vm["threads"].as<int>();
+    PhaseTimer timer;
+    const auto runStart = PhaseTimer::now();
+
+    // approximate bytes held by the main structures; for structures built more than once, the largest
+    map<string,size_t> structureBytes;
+    mutex structureBytesMutex;
+    auto recordBytes = [&] (const string& structure, size_t bytes) {
+      lock_guard<mutex> lock (structureBytesMutex);
+      structureBytes[structure] = max (structureBytes[structure], bytes);
+    };
+    // statistics go to a file, or (given '-') into the output JSON
+    auto statsJSON = [&] () -> string {
+      list<string> bytesJson;
+      for (auto& sb : structureBytes)
+	bytesJson.push_back (string("\"") + sb.first + "\":" + to_string(sb.second));
+      ostringstream json;
+      json << "{\"wallSeconds\":" << std::chrono::duration<double> (PhaseTimer::Clock::now() - runStart.wall).count()
+	   << ",\"cpuSeconds\":" << PhaseTimer::cpuSeconds()
+	   << ",\"peakRssBytes\":" << PhaseTimer::peakRssBytes()
+	   << ",\"phases\":" << timer.toJSON()
+	   << ",\"bytes\":{" << join(bytesJson,",") << "}}";
+      return json.str();
+    };
+    const bool statsInOutput = vm.count("stats") && vm["stats"].as<string>() == "-";
+    auto statsOutput = [&] () -> string {
+      return statsInOutput ? (string(",\"stats\":") + statsJSON()) : string();
+    };
+    auto addStatsToSummary = [&] (MCMC::Summary& summ) {
+      if (statsInOutput)
+	summ.extraJSON += string(summ.extraJSON.empty() ? "" : ",") + "\"stats\":" + statsJSON();
+    };
+    auto writeStats = [&] () {
+      if (vm.count("stats") && !statsInOutput) {
+	ofstream out (vm["stats"].as<string>());
+	out << statsJSON() << endl;
+      }
+    };
+
     Ontology ontology;
-    if (vm.count("ontology")) {
-      auto ontologyPath = vm["ontology"].as<string>();
-      ifstream in (ontologyPath);
-      if (!in)
-	Abort ("File not found: %s", ontologyPath.c_str());
-      ontology.parseOBO (in);
-      LogThisAt(1,"Read " << ontology.terms() << "-term ontology from " << ontologyPath << endl);
-    } else {
+    AssocsIndex index;
+    const bool loadIndex = vm.count("index");
+    if (!vm.count("ontology") && !loadIndex)
       throw runtime_error ("You must specify an ontology");
+    Require (!loadIndex || !(vm.count("ontology") || vm.count("assocs") || vm.count("update-index") || vm.count("prune") || vm.count("by-namespace")),
+	     "A binary index replaces --ontology & --assocs, and is incompatible with --update-index, --prune and --by-namespace");
+    Require (!vm.count("prune") || !(vm.count("save-index") || vm.count("update-index")), "Pruned ontologies can't be indexed");
+    Require (!vm.count("by-namespace") || !(vm.count("save-index") || vm.count("update-index")), "Per-namespace analyses can't be indexed");
+    string ontologyPath;
+    ifstream ontologyIn;
+    if (!loadIndex) {
+      ontologyPath = vm["ontology"].as<string>();
+      ontologyIn.open (ontologyPath);
+      if (!ontologyIn)
+	Abort ("File not found: %s", ontologyPath.c_str());
     }
 
-    Assocs assocs (ontology);
-    if (vm.count("assocs")) {
-      auto assocsPath = vm["assocs"].as<string>();
-      ifstream in (assocsPath);
-      if (!in)
+    // given threads to spare, the associations are parsed while the ontology is
+    Assocs::GeneTermList geneTermList;
+    string assocsPath;
+    ifstream assocsIn;
+    auto readAssocs = [&] () {
+      const auto start = PhaseTimer::now();
+      geneTermList = Assocs::readGOA (assocsIn);
+      timer.add ("parse associations", start);
+    };
+    list<thread> assocsThread;
+    if (vm.count("assocs") && !vm.count("reanalyze")) {
+      assocsPath = vm["assocs"].as<string>();
+      assocsIn.open (assocsPath);
+      if (!assocsIn)
 	Abort ("File not found: %s", assocsPath.c_str());
-      assocs.parseGOA (in);
-      LogThisAt(1,"Read " << assocs.nAssocs << " associations (" << assocs.genes() << " genes, " << assocs.relevantTerms().size() << " terms) from " << assocsPath << endl);
+      if (nThreads > 1)
+	assocsThread.push_back (thread (readAssocs));
+    }
+
+    auto phaseStart = PhaseTimer::now();
+    string indexPath;
+    if (loadIndex) {
+      indexPath = vm["index"].as<string>();
+      ifstream indexIn (indexPath, ios::binary);
+      if (!indexIn)
+	Abort ("File not found: %s", indexPath.c_str());
+      index.read (indexIn);
+      index.initOntology (ontology);
+      timer.add ("read index", phaseStart);
+      LogThisAt(1,"Read " << ontology.terms() << "-term ontology from " << indexPath << endl);
     } else {
-      throw runtime_error ("You must specify a gene-term associations file");
+      ontology.parseOBO (ontologyIn);
+      timer.add ("parse ontology", phaseStart);
+      LogThisAt(1,"Read " << ontology.terms() << "-term ontology from " << ontologyPath << endl);
+    }
+
+    auto writeBenchmarkCSV = [&] (const Benchmarker& benchmarker) {
+      if (vm.count("bench-csv")) {
+	const string dir = vm["bench-csv"].as<string>();
+	ofstream hypOut (dir + "/hypergeometric.csv"), modelOut (dir + "/model.csv");
+	Benchmarker::writeCSV (hypOut, benchmarker.hypergeometric);
+	Benchmarker::writeCSV (modelOut, benchmarker.model);
+      }
+    };
+
+    if (vm.count("reanalyze")) {
+      Benchmarker benchmarker (ontology);
+      benchmarker.nThreads = vm["threads"].as<int>();
+      readBenchmarkJSON (benchmarker, vm["reanalyze"].as<string>());
+      LogThisAt(1,"Read " << benchmarker.datasets.size() << " benchmark datasets from " << vm["reanalyze"].as<string>() << endl);
+      benchmarker.analyze();
+      writeBenchmarkCSV (benchmarker);
+      cout << "{\"analysis\":" << benchmarker.analysisToJSON() << "}" << endl;
+      return 0;
     }
 
     vguard<Assocs::GeneNameSet> geneSets;
@@ -81,8 +324,130 @@ int main (int argc, char** argv) {
 	geneSets.push_back (Assocs::parseGeneSet (in));
 	LogThisAt(1,"Read " << geneSets.back().size() << " genes from " << geneSetPath << endl);
       }
-    } else
-      throw runtime_error ("You must specify at least one file of gene names (one per line)");
+    }
+    vguard<Assocs::NamedGeneSet> batchSets;
+    if (vm.count("gmt")) {
+      Require (geneSets.empty() && !vm.count("simulate") && !vm.count("benchmark") && !vm.count("bench-reps") && !vm.count("by-namespace"),
+	       "Batch mode is incompatible with --genes, simulation and per-namespace analysis");
+      Require (!vm.count("init-terms") && !vm.count("warm-start") && !vm.count("edit-genes"),
+	       "Batch mode is incompatible with --init-terms, --warm-start and --edit-genes");
+      const string gmtPath = vm["gmt"].as<string>();
+      ifstream in (gmtPath);
+      if (!in)
+	Abort ("File not found: %s", gmtPath.c_str());
+      batchSets = Assocs::parseGMT (in);
+      LogThisAt(1,"Read " << plural(batchSets.size(),"gene set") << " from " << gmtPath << endl);
+    }
+
+    if (!vm.count("assocs") && !loadIndex)
+      throw runtime_error ("You must specify a gene-term associations file");
+    if (assocsThread.size())
+      assocsThread.front().join();
+    else if (!loadIndex)
+      readAssocs();
+
+    // per-namespace subgraphs are taken before pruning, which is then applied to each.
+    // the full ontology is then dropped, so no associations or closure are built for it
+    const bool byNamespace = vm.count("by-namespace");
+    vguard<string> nsName;
+    vguard<Ontology> nsOntology;
+    if (byNamespace) {
+      Require (!vm.count("simulate") && !vm.count("benchmark") && !vm.count("bench-reps"), "Per-namespace analysis is incompatible with simulation");
+      for (auto& ns : ontology.namespaces()) {
+	nsName.push_back (ns);
+	nsOntology.push_back (ontology.namespaceSubgraph (ns));
+      }
+      Require (nsName.size() > 0, "Ontology has no namespace tags");
+      ontology = Ontology();
+    }
+
+    phaseStart = PhaseTimer::now();
+    if (vm.count("prune")) {
+      // seed with the terms annotated to any gene, or only to genes in the gene sets
+      const string prune = vm["prune"].as<string>();
+      set<Assocs::GeneName> seedGenes;
+      if (prune == "genes") {
+	Require (!vm.count("simulate") && !vm.count("benchmark") && !vm.count("bench-reps"), "Pruning to the gene sets' terms is incompatible with simulation");
+	for (auto& gs : geneSets)
+	  seedGenes.insert (gs.begin(), gs.end());
+	for (auto& ngs : batchSets)
+	  seedGenes.insert (ngs.second.begin(), ngs.second.end());
+      } else if (prune != "annotated")
+	Fail ("Unknown pruning mode: %s", prune.c_str());
+      set<Ontology::TermName> seedTerms;
+      for (auto& gt : geneTermList)
+	if (prune == "annotated" || seedGenes.count(gt.first))
+	  seedTerms.insert (gt.second);
+      if (byNamespace)
+	for (size_t n = 0; n < nsOntology.size(); ++n) {
+	  const Ontology::TermIndex unprunedTerms = nsOntology[n].terms();
+	  nsOntology[n].prune (seedTerms);
+	  LogThisAt(1,"Pruned namespace " << nsName[n] << " to " << nsOntology[n].terms() << " of " << unprunedTerms << " terms" << endl);
+	}
+      else {
+	const Ontology::TermIndex unprunedTerms = ontology.terms();
+	ontology.prune (seedTerms);
+	LogThisAt(1,"Pruned ontology to " << ontology.terms() << " of " << unprunedTerms << " terms" << endl);
+      }
+      timer.add ("prune ontology", phaseStart);
+    }
+
+    phaseStart = PhaseTimer::now();
+    Assocs assocs (ontology);
+    assocs.nThreads = nThreads;
+    string indexDiffJson;
+    if (loadIndex) {
+      index.initAssocs (assocs);
+      assocsPath = indexPath;
+    } else if (vm.count("update-index")) {
+      const string prevPath = vm["update-index"].as<string>();
+      ifstream prevIn (prevPath, ios::binary);
+      if (!prevIn)
+	Abort ("File not found: %s", prevPath.c_str());
+      AssocsIndex previous;
+      previous.read (prevIn);
+      timer.add ("read index", phaseStart);
+      phaseStart = PhaseTimer::now();
+      const AssocsIndex::Diff diff = index.update (previous, ontology, geneTermList);
+      timer.add ("update index", phaseStart);
+      phaseStart = PhaseTimer::now();
+      index.initAssocs (assocs);
+      indexDiffJson = diff.toJSON();
+      LogThisAt(1,"Updated index from " << prevPath << ": " << indexDiffJson << endl);
+    } else if (vm.count("save-index")) {
+      index.build (ontology, geneTermList, nThreads);
+      index.initAssocs (assocs);
+    } else if (!byNamespace)  // each namespace's associations are built by its own analysis
+      assocs.init (geneTermList, &timer);
+    if (!byNamespace)
+      timer.add ("assocs init", phaseStart);
+    if (vm.count("save-index")) {
+      phaseStart = PhaseTimer::now();
+      const string savePath = vm["save-index"].as<string>();
+      ofstream indexOut (savePath, ios::binary);
+      if (!indexOut)
+	Abort ("Can't write %s", savePath.c_str());
+      index.write (indexOut);
+      timer.add ("save index", phaseStart);
+      LogThisAt(1,"Saved index to " << savePath << endl);
+    }
+    if (byNamespace)
+      LogThisAt(1,"Split ontology into " << plural(nsName.size(),"namespace") << ": " << join(nsName,", ") << endl);
+    else {
+      recordBytes ("ontology", ontology.bytes());
+      recordBytes ("genesByTerm", assocs.genesByTermBytes());
+      recordBytes ("termsByGene", assocs.termsByGeneBytes());
+      LogThisAt(1,"Read " << assocs.nAssocs << " associations (" << assocs.genes() << " genes, " << assocs.relevantTerms().size() << " terms) from " << assocsPath << endl);
+    }
+    LogThisAt(1,"Startup phases: " << timer.toString() << endl);
+
+    // with nothing to analyze, saving an index is all there is to do
+    if (vm.count("save-index") && geneSets.empty() && !vm.count("gmt") && !vm.count("simulate") && !vm.count("benchmark") && !vm.count("bench-reps")) {
+      cout << "{\"index\":{\"terms\":" << ontology.terms() << ",\"genes\":" << assocs.genes() << ",\"associations\":" << assocs.nAssocs
+	   << (indexDiffJson.empty() ? string() : (string(",\"diff\":") + indexDiffJson)) << "}" << statsOutput() << "}" << endl;
+      writeStats();
+      return 0;
+    }
 
     Parameterization parameterization (assocs);
     BernoulliParamSet& params (parameterization.params);
@@ -97,23 +462,302 @@ int main (int argc, char** argv) {
     
     Model::RandomGenerator generator (vm["rnd-seed"].as<int>());
 
-    MCMC mcmc (assocs, parameterization.params, prior);
-    mcmc.moveRate[Model::Flip] = vm["flip-rate"].as<double>();
-    mcmc.moveRate[Model::Step] = vm["step-rate"].as<double>();
-    mcmc.moveRate[Model::Jump] = vm["jump-rate"].as<double>();
-    mcmc.moveRate[Model::Randomize] = vm["randomize-rate"].as<double>();
-    
-    mcmc.initModels (geneSets);
+    MCMC::MapMethod mapMethod = MCMC::Anneal;
+    if (vm.count("map")) {
+      const string method = vm["map"].as<string>();
+      if (method == "anneal")
+	mapMethod = MCMC::Anneal;
+      else if (method == "greedy")
+	mapMethod = MCMC::Greedy;
+      else
+	Fail ("Unknown MAP search method: %s", method.c_str());
+      Require (!vm.count("uncollapsed") && vm["replicas"].as<int>() == 1 && !vm.count("edit-genes") && !vm.count("partial"),
+	       "MAP search is incompatible with --uncollapsed, --replicas, --edit-genes and --partial");
+      Require (vm["restarts"].as<int>() > 0 && vm["map-steps"].as<int>() >= 0, "MAP search needs at least one restart");
+      Require (vm["anneal-from"].as<double>() > 0 && vm["anneal-to"].as<double>() > 0, "Annealing inverse temperatures must be positive");
+    }
+    Require (!vm.count("variational") || !(vm.count("map") || vm.count("uncollapsed") || vm["replicas"].as<int>() > 1 || vm.count("edit-genes") || vm.count("partial")),
+	     "Variational inference is incompatible with --map, --uncollapsed, --replicas, --edit-genes and --partial");
+    Require (!vm.count("adapt-rates") || !(vm.count("uncollapsed") || vm.count("map") || vm.count("variational")),
+	     "Move rates are only adapted by the collapsed sampler");
+    Require (!vm.count("rao-blackwell") || !(vm.count("uncollapsed") || vm.count("map") || vm.count("variational")),
+	     "Rao-Blackwellized estimates are only made by the collapsed sampler");
+    Require (!vm.count("partial") || !(vm.count("simulate") || vm.count("benchmark") || vm.count("bench-reps") || vm.count("by-namespace")),
+	     "Partial results can't be saved for simulations, benchmarks or per-namespace analyses");
+    const uint64_t contentHash = vm.count("partial") ? MCMC::Partial::hashContent (assocs, params, prior) : 0;
 
-    const int samplesPerTerm = vm["samples"].as<int>(), nSamples = samplesPerTerm * mcmc.nVariables;
-    const int burnPerTerm = vm["burn"].as<int>(), burn = burnPerTerm * mcmc.nVariables;
-    LogThisAt(1,"Model has " << mcmc.nVariables << " variables; running MCMC for " << nSamples << " steps + " << burn << " burn-in" << endl);
+    const int samplesPerTerm = vm["samples"].as<int>(), burnPerTerm = vm["burn"].as<int>();
+    // batch mode runs many analyses at once, so each one is single-threaded & untimed
+    size_t inferenceThreads = nThreads;
+    PhaseTimer* inferenceTimer = &timer;
+    // if partial is non-null, the raw counts are stored there too
+    auto runInference = [&] (const Assocs& assocs, const vguard<Assocs::GeneNameSet>& geneSets, Model::RandomGenerator& generator, MCMC::Partial* partial) -> MCMC::Summary {
+      MCMC mcmc (assocs, parameterization.params, prior);
+      mcmc.moveRate[Model::Flip] = vm["flip-rate"].as<double>();
+      mcmc.moveRate[Model::Step] = vm["step-rate"].as<double>();
+      mcmc.moveRate[Model::Jump] = vm["jump-rate"].as<double>();
+      mcmc.moveRate[Model::Randomize] = vm["randomize-rate"].as<double>();
+      mcmc.moveRate[Model::MultipleTry] = vm["multi-try-rate"].as<double>();
+      mcmc.adaptMoveRates = vm.count("adapt-rates");
+      mcmc.multipleTries = vm["multi-tries"].as<int>();
+      const string tryType = vm["multi-try-type"].as<string>();
+      if (tryType == "flip")
+	mcmc.multipleTryType = Model::Flip;
+      else if (tryType == "step")
+	mcmc.multipleTryType = Model::Step;
+      else if (tryType == "jump")
+	mcmc.multipleTryType = Model::Jump;
+      else
+	Fail ("Unknown multiple-try move type: %s", tryType.c_str());
+      Require (mcmc.multipleTries > 0, "Multiple-try moves need at least one candidate");
 
-    mcmc.burn = burn;
-    mcmc.run (nSamples + burn, generator);
+      mcmc.nThreads = inferenceThreads;
+      mcmc.maxEnumeratedTerms = vm["enumerate-max"].as<int>();
+      Require (mcmc.maxEnumeratedTerms < 32, "Can't enumerate groups of more than 31 terms");
+      mcmc.timer = inferenceTimer;
 
-    auto summ = mcmc.summary();
-    cout << summ.toJSON() << endl;
+      // with more than one replica, mcmc is just a template for the replicas' settings
+      const int nReplicas = vm["replicas"].as<int>();
+      Require (nReplicas > 0, "Need at least one replica");
+      Require (vm["hottest"].as<double>() > 0 && vm["hottest"].as<double>() <= 1, "Inverse temperature of hottest replica must be in (0,1]");
+      Require (nReplicas == 1 || !vm.count("uncollapsed"), "Replica exchange is only implemented for the collapsed sampler");
+      ReplicaExchange chains (mcmc, nReplicas, vm["hottest"].as<double>());
+      chains.swapInterval = vm["swap-every"].as<int>();
+      chains.nThreads = inferenceThreads;
+      Require (chains.swapInterval > 0, "Swap interval must be positive");
+
+      const auto initStart = PhaseTimer::now();
+      chains.initModels (geneSets);
+      if (inferenceTimer)
+	LogThisAt(1,"Initialized " << plural(geneSets.size(),"model") << " in " << inferenceTimer->add ("model init", initStart) << " seconds" << endl);
+      size_t modelBytes = 0, occupancyBytes = 0;
+      for (auto& replica : chains.replicas) {
+	modelBytes += replica.modelBytes();
+	occupancyBytes += replica.occupancyBytes();
+      }
+      if (vm.count("rao-blackwell"))
+	for (auto& replica : chains.replicas)
+	  replica.raoBlackwellInterval = max (vm["rao-blackwell"].as<int>(), 1) * replica.nVariables;
+      recordBytes ("models", modelBytes);
+      recordBytes ("occupancy", occupancyBytes);
+      const MCMC& front = chains.replicas.front();  // replicas share gene sets & variables
+
+      vguard<vguard<Ontology::TermName> > initTerms;
+      if (vm.count("warm-start")) {
+	initTerms = readWarmStartJSON (vm["warm-start"].as<string>());
+	LogThisAt(1,"Read initial terms for " << initTerms.size() << " gene sets from " << vm["warm-start"].as<string>() << endl);
+      }
+      if (vm.count("init-terms")) {
+	// explicit lists take the place of warm-start lists for the same gene sets
+	const vector<string>& lists = vm["init-terms"].as<vector<string> >();
+	if (initTerms.size() < lists.size())
+	  initTerms.resize (lists.size());
+	for (size_t n = 0; n < lists.size(); ++n)
+	  initTerms[n] = split (lists[n], ",");
+      }
+      for (auto& replica : chains.replicas)
+	for (MCMC::ModelIndex m = 0; m < initTerms.size() && m < replica.models.size(); ++m)
+	  replica.setInitialTerms (m, initTerms[m]);
+
+      if (vm.count("map")) {
+	MCMC& chain = chains.replicas.front();
+	const int nSteps = vm["map-steps"].as<int>() * chain.nVariables, nRestarts = vm["restarts"].as<int>();
+	LogThisAt(1,"Model has " << chain.nVariables << " variables; searching for MAP state with " << plural(nRestarts,"restart") << " of " << nSteps << " moves" << endl);
+	const auto searchStart = PhaseTimer::now();
+	const LogProb logLike = chain.nVariables ? chain.searchMAP (mapMethod, nSteps, nRestarts, generator, vm["anneal-from"].as<double>(), vm["anneal-to"].as<double>()) : chain.currentLogLikelihood();
+	if (inferenceTimer)
+	  inferenceTimer->add ("MAP search", searchStart);
+	MCMC::Summary summ = chain.stateSummary();
+	summ.extraJSON = string("\"map\":{\"method\":\"") + vm["map"].as<string>() + "\",\"logLikelihood\":" + to_string(logLike) + "}";
+	return summ;
+      }
+
+      if (vm.count("variational")) {
+	MeanField meanField (front);
+	meanField.nThreads = inferenceThreads;
+	meanField.maxSweeps = vm["vb-sweeps"].as<int>();
+	meanField.tolerance = vm["vb-tolerance"].as<double>();
+	LogThisAt(1,"Model has " << front.nVariables << " variables; running up to " << plural(meanField.maxSweeps,"variational sweep") << endl);
+	const auto vbStart = PhaseTimer::now();
+	meanField.run();
+	if (inferenceTimer)
+	  inferenceTimer->add ("variational", vbStart);
+	MCMC::Summary summ = meanField.summary();
+	summ.extraJSON = meanField.statsToJSON();
+	return summ;
+      }
+
+      auto sample = [&] () {
+	if (vm.count("uncollapsed")) {
+	  // each sweep samples every term once
+	  MCMC& chain = chains.replicas.front();
+	  LogThisAt(1,"Model has " << chain.nVariables << " variables; running uncollapsed MCMC for " << samplesPerTerm << " sweeps + " << burnPerTerm << " burn-in" << endl);
+	  chain.burn = burnPerTerm;
+	  chain.runUncollapsed (samplesPerTerm + burnPerTerm, generator);
+	} else {
+	  const int nSamples = samplesPerTerm * front.nVariables, burn = burnPerTerm * front.nVariables;
+	  LogThisAt(1,"Model has " << front.nVariables << " variables; running MCMC for " << nSamples << " steps + " << burn << " burn-in" << (nReplicas > 1 ? (string(" on each of ") + to_string(nReplicas) + " replicas") : string()) << endl);
+	  for (auto& replica : chains.replicas)
+	    replica.burn = burn;
+	  chains.run (nSamples + burn, generator);
+	}
+      };
+      sample();
+
+      if (vm.count("edit-genes")) {
+	auto editPaths = vm["edit-genes"].as<vector<string> >();
+	Require (editPaths.size() == front.models.size(), "Number of edited gene sets (%u) does not match number of gene sets (%u)", editPaths.size(), front.models.size());
+	for (MCMC::ModelIndex m = 0; m < editPaths.size(); ++m) {
+	  ifstream in (editPaths[m]);
+	  if (!in)
+	    Abort ("File not found: %s", editPaths[m].c_str());
+	  const Assocs::GeneNameSet geneNames = Assocs::parseGeneSet (in);
+	  for (auto& replica : chains.replicas)
+	    replica.updateGeneSet (m, geneNames);
+	  LogThisAt(1,"Edited gene set #" << (m+1) << " to " << front.geneSets[m].size() << " genes from " << editPaths[m] << endl);
+	}
+	sample();
+      }
+
+      const auto summaryStart = PhaseTimer::now();
+      MCMC::Summary summ = chains.summary();
+      if (partial) {
+	*partial = chains.partial();
+	partial->contentHash = contentHash;
+      }
+      if (inferenceTimer)
+	inferenceTimer->add ("summary", summaryStart);
+      return summ;
+    };
+
+    auto writePartial = [&] (const MCMC::Partial& partial) {
+      const string partialPath = vm["partial"].as<string>();
+      ofstream out (partialPath, ios::binary);
+      if (!out)
+	Abort ("Can't write %s", partialPath.c_str());
+      partial.write (out);
+      LogThisAt(1,"Saved partial result to " << partialPath << endl);
+    };
+
+    Simulator simulator (assocs, parameterization, prior);
+    if (vm.count("false-pos"))
+      simulator.simParams["fp"] = vm["false-pos"].as<double>();
+    if (vm.count("false-neg"))
+      simulator.simParams["fn"] = vm["false-neg"].as<double>();
+    if (vm.count("active-terms"))
+      simulator.nActiveTerms = vm["active-terms"].as<int>();
+    if (vm.count("exclude-with"))
+      simulator.termAssociationCutoff = vm["exclude-with"].as<int>();
+    simulator.excludeRedundantTerms = vm.count("exclude-redundant");
+    simulator.excludeAncestralTerms = vm.count("exclude-ancestral");
+    simulator.nThreads = vm["threads"].as<int>();
+    const int nSimulated = vm.count("simulate") ? vm["simulate"].as<int>() : 1;
+
+    const string modelJson = string("{\"prior\":") + prior.toJSON(params.paramName) + "}";
+    if (vm.count("benchmark") || vm.count("bench-reps")) {
+      const int benchReps = vm.count("bench-reps") ? vm["bench-reps"].as<int>() : 1;
+      Benchmarker benchmarker (ontology);
+      benchmarker.nThreads = vm["threads"].as<int>();
+      list<string> benchJson;
+      for (int benchRep = 0; benchRep < benchReps; ++benchRep) {
+	LogThisAt(1,"Starting benchmark repetition #" << (benchRep+1) << endl);
+	const Simulator::Simulation sim = simulator.sampleGeneSets (nSimulated, generator);
+	const MCMC::Summary summ = runInference (assocs, sim.observedGeneSets (assocs), generator, NULL);
+	benchmarker.add (sim, summ);
+	list<string> samplesJson;
+	for (size_t n = 0; n < sim.samples.size(); ++n)
+	  samplesJson.push_back (sim.samples[n].toJSON (assocs, summ.geneSetSummary[n].toJSON()));
+	benchJson.push_back (string("{\"benchmarkDataset\":") + to_string(benchRep+1) + ",\"simulation\":{\"params\":" + sim.paramsToJSON(params) + ",\"samples\":[" + join(samplesJson,",") + "]}}");
+      }
+      benchmarker.analyze();
+      writeBenchmarkCSV (benchmarker);
+      cout << "{\"model\":" << modelJson << ",\"benchmark\":[" << join(benchJson,",") << "],\"analysis\":" << benchmarker.analysisToJSON() << statsOutput() << "}" << endl;
+
+    } else if (vm.count("simulate")) {
+      const Simulator::Simulation sim = simulator.sampleGeneSets (nSimulated, generator);
+      list<string> samplesJson;
+      for (auto& sample : sim.samples)
+	samplesJson.push_back (sample.toJSON (assocs));
+      cout << "{\"model\":" << modelJson << ",\"simulation\":{\"params\":" << sim.paramsToJSON(params) << ",\"samples\":[" << join(samplesJson,",") << "]}" << statsOutput() << "}" << endl;
+
+    } else if (vm.count("gmt")) {
+      // idle threads take the next unstarted set; each set's random numbers depend only on its index
+      inferenceThreads = 1;
+      inferenceTimer = NULL;
+      const uint64_t seed = vm["rnd-seed"].as<int>();
+      atomic<size_t> nextSet (0);
+      mutex outputMutex;
+      vguard<MCMC::Partial> setPartial (vm.count("partial") ? batchSets.size() : 0);
+      phaseStart = PhaseTimer::now();
+      auto analyze = [&] () {
+	for (size_t n; (n = nextSet++) < batchSets.size(); ) {
+	  Model::RandomGenerator setGenerator (derive_seed (seed, n));
+	  const MCMC::Summary summ = runInference (assocs, vguard<Assocs::GeneNameSet> (1, batchSets[n].second), setGenerator,
+						       setPartial.empty() ? NULL : &setPartial[n]);
+	  if (setPartial.size())
+	    setPartial[n].geneSetPartial.front().name = batchSets[n].first;
+	  string name;
+	  write_quoted_escaped (batchSets[n].first, back_inserter (name));
+	  lock_guard<mutex> lock (outputMutex);
+	  cout << "{\"index\":" << n << ",\"name\":" << name << ",\"result\":" << summ.toJSON() << "}" << endl;
+	  LogThisAt(2,"Finished gene set #" << (n+1) << " (" << batchSets[n].first << ")" << endl);
+	}
+      };
+      list<thread> threads;
+      for (size_t t = 0; t < nThreads; ++t)
+	threads.push_back (thread (analyze));
+      for (auto& thr: threads)
+	thr.join();
+      timer.add ("batch", phaseStart);
+      if (vm.count("partial")) {
+	MCMC::Partial merged;
+	for (auto& part : setPartial)
+	  merged.merge (part);
+	writePartial (merged);
+      }
+      if (statsInOutput)
+	cout << "{\"stats\":" << statsJSON() << "}" << endl;
+
+    } else {
+      if (geneSets.empty())
+	throw runtime_error ("You must specify at least one file of gene names (one per line)");
+
+      if (byNamespace) {
+	// one analysis per namespace, each on its own thread with its own random number stream
+	vguard<Model::RandomGenerator> nsGenerator;
+	for (size_t n = 0; n < nsName.size(); ++n)
+	  nsGenerator.push_back (split_generator (generator));
+	vguard<MCMC::Summary> nsSummary (nsName.size());
+	auto analyze = [&] (size_t n) {
+	  Assocs nsAssocs (nsOntology[n]);
+	  nsAssocs.init (geneTermList);
+	  recordBytes ("ontology", nsOntology[n].bytes());
+	  recordBytes ("genesByTerm", nsAssocs.genesByTermBytes());
+	  recordBytes ("termsByGene", nsAssocs.termsByGeneBytes());
+	  LogThisAt(1,"Namespace " << nsName[n] << ": " << nsOntology[n].terms() << " terms, " << nsAssocs.nAssocs << " associations" << endl);
+	  nsSummary[n] = runInference (nsAssocs, geneSets, nsGenerator[n], NULL);
+	};
+	list<thread> threads;
+	for (size_t n = 0; n < nsName.size(); ++n)
+	  threads.push_back (thread (analyze, n));
+	for (auto& thr: threads)
+	  thr.join();
+	map<string,MCMC::Summary> summByNamespace;
+	for (size_t n = 0; n < nsName.size(); ++n)
+	  summByNamespace[nsName[n]] = nsSummary[n];
+	MCMC::Summary summ = MCMC::Summary::combine (summByNamespace, "namespace");
+	addStatsToSummary (summ);
+	cout << summ.toJSON() << endl;
+      } else {
+	MCMC::Partial partial;
+	auto summ = runInference (assocs, geneSets, generator, vm.count("partial") ? &partial : NULL);
+	if (vm.count("partial"))
+	  writePartial (partial);
+	addStatsToSummary (summ);
+	cout << summ.toJSON() << endl;
+      }
+    }
+    writeStats();
     
   } catch (const std::exception& e) {
     cerr << e.what() << endl;